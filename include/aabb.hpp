@@ -0,0 +1,70 @@
+#pragma once
+
+#include "interval.hpp"
+#include "ray.hpp"
+
+// Axis aligned bounding box, stored as one interval per axis.
+class aabb {
+   public:
+    interval x, y, z;
+
+    // The default box is empty, since intervals are empty by default.
+    HD aabb() : x(+inf, -inf), y(+inf, -inf), z(+inf, -inf) {}
+
+    HD aabb(const interval& x, const interval& y, const interval& z)
+        : x(x), y(y), z(z) {}
+
+    HD aabb(const point3& a, const point3& b) {
+        // Treat the two points a and b as extrema for the bounding box, so we
+        // don't require a particular minimum/maximum coordinate order.
+        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+    }
+
+    HD aabb(const aabb& box0, const aabb& box1) {
+        x = interval(fmin(box0.x.min, box1.x.min), fmax(box0.x.max, box1.x.max));
+        y = interval(fmin(box0.y.min, box1.y.min), fmax(box0.y.max, box1.y.max));
+        z = interval(fmin(box0.z.min, box1.z.min), fmax(box0.z.max, box1.z.max));
+    }
+
+    HD const interval& axis_interval(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    HD point3 min() const { return point3(x.min, y.min, z.min); }
+    HD point3 max() const { return point3(x.max, y.max, z.max); }
+    HD point3 centroid() const { return 0.5 * (min() + max()); }
+
+    // Returns the index of the longest axis of the bounding box.
+    HD int longest_axis() const {
+        if (x.size() > y.size()) return x.size() > z.size() ? 0 : 2;
+        return y.size() > z.size() ? 1 : 2;
+    }
+
+    HD bool hit(const ray& r, interval ray_t) const {
+        const point3& ray_orig = r.origin();
+        const vec3& ray_dir = r.direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = axis_interval(axis);
+            const double adinv = 1.0 / ray_dir[axis];
+
+            auto t0 = (ax.min - ray_orig[axis]) * adinv;
+            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+
+            if (t0 < t1) {
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+            } else {
+                if (t1 > ray_t.min) ray_t.min = t1;
+                if (t0 < ray_t.max) ray_t.max = t0;
+            }
+
+            if (ray_t.max <= ray_t.min) return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "render_job.hpp"
+
+// One camera of a batch and the file its image goes to.
+struct render_view {
+    std::string output;
+    cu_camera camera;
+};
+
+/* Reads the views of a batch from `path`, one directive per line:
+ *
+ *     view    <output> <from x y z> <at x y z> [fov] [width]
+ *     stereo  <prefix> <from x y z> <at x y z> <eye distance> [fov] [width]
+ *     cubemap <prefix> <center x y z> [width]
+ *
+ * `stereo` adds <prefix>.left.ppm and <prefix>.right.ppm, with the eyes
+ * offset sideways and parallel view axes; `cubemap` adds the six square 90
+ * degree faces <prefix>.{px,nx,py,ny,pz,nz}.ppm, the side faces with y up.
+ * Unset settings come from `base`. Blank lines and lines starting with '#'
+ * are skipped. The cameras are returned initialised.
+ */
+bool load_views(const std::string& path, const cu_camera& base,
+                std::vector<render_view>& views);
+
+/* Renders all `views` of `scene` as render jobs on the global pool, so tiles
+ * of different views run side by side. Earlier views get a higher priority:
+ * they finish in order and free their buffers, while the tiles of later views
+ * keep the workers busy through each view's tail. A bounded number of views
+ * is in flight at a time.
+ *
+ * `on_view` is called on the calling thread with every finished view, in
+ * completion order; returning false cancels the rest of the batch. Returns
+ * true when all views rendered and were accepted.
+ */
+bool render_batch(
+    std::shared_ptr<const Allocator> scene,
+    const std::vector<render_view>& views, const render_options& opts,
+    const std::function<bool(size_t index, const job_result& result)>&
+        on_view);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+#include "aabb.hpp"
+
+/* Node of a flat bounding volume hierarchy. The children of an internal node
+ * are stored next to each other, so `first` is the index of the left child and
+ * the right child is `first + 1`. Leaves reference `count` consecutive entries
+ * of the primitive order starting at `first`.
+ */
+struct bvh_node {
+    aabb box;
+    int first;
+    int count;  // 0 for internal nodes
+    int axis;   // Split axis of internal nodes
+};
+
+/* Builds a hierarchy over the primitive bounding `boxes` by median splits
+ * along the longest axis of the centroid bounds. `order` receives the
+ * primitive indices in the order the leaves reference them. `boxes` must not
+ * be empty: the root would be a leaf of count 0, which reads as internal.
+ */
+std::vector<bvh_node> build_bvh(const std::vector<aabb>& boxes,
+                                std::vector<int>& order, int leaf_size = 2);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "render_buffer.hpp"
+
+/* Checkpoint files are a fixed header followed by the raw accumulation buffer
+ * (3 doubles per pixel), the per-pixel sample counts (uint32) and, since
+ * version 2, the per-pixel sums of squared luminance (double). The random
+ * state of a pixel is fully determined by the seed and its sample count (see
+ * sample_seed), so nothing else is needed to continue exactly where a render
+ * stopped.
+ */
+struct checkpoint_header {
+    char magic[4] = {'R', 'T', 'C', 'K'};
+    unsigned int version = 2;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned long long seed = 0;
+};
+
+// Writes `buffer` to `path`. The file is written next to `path` first and
+// renamed over it, so a crash while saving never destroys the last checkpoint.
+bool save_checkpoint(const std::string& path, const render_buffer& buffer);
+
+bool load_checkpoint(const std::string& path, render_buffer& buffer);
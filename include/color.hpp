@@ -14,15 +14,17 @@ inline double linear_to_gamma(double linear_component) {
     return 0;
 }
 
-inline void write_color(std::ostream &out, const color3 &color) {
-    auto r = linear_to_gamma(color.x());
-    auto g = linear_to_gamma(color.y());
-    auto b = linear_to_gamma(color.z());
-
+// Gamma corrected 8-bit components of a linear color.
+inline void color_to_bytes(const color3 &color, unsigned char rgb[3]) {
     static const interval intensity(0.0, 0.999);
+    for (int c = 0; c < 3; c++)
+        rgb[c] = int(256 * intensity.clamp(linear_to_gamma(color[c])));
+}
 
-    out << int(256 * intensity.clamp(r)) << " " << int(256 * intensity.clamp(g))
-        << " " << int(256 * intensity.clamp(b)) << "\n";
+inline void write_color(std::ostream &out, const color3 &color) {
+    unsigned char rgb[3];
+    color_to_bytes(color, rgb);
+    out << int(rgb[0]) << " " << int(rgb[1]) << " " << int(rgb[2]) << "\n";
 }
 
 #endif
@@ -1,8 +1,20 @@
 #pragma once
 
+#include <memory>
+#include <string>
 #include <vector>
+#include "../aabb.hpp"
+#include "../environment.hpp"
+#include "../mesh.hpp"
+#include "../paged_scene.hpp"
+#include "../sphere_cloud.hpp"
+#include "../texture_cache.hpp"
+#include "../transform.hpp"
+#include "../volume.hpp"
 #include "cu_camera.hpp"
 #include "cu_material.hpp"
+#include "options.hpp"
+#include "render_buffer.hpp"
 
 class Allocator {
    public:
@@ -11,15 +23,132 @@ class Allocator {
 
     cu_hittable** allocate_list();
 
+    // Builds a bounding volume hierarchy over all hittables allocated so far
+    // and makes it the world.
+    cu_hittable** allocate_bvh();
+
+    // Places `object` (e.g. the world of another Allocator, with bounds
+    // `object_box`) into this scene. A non-null `mat` replaces the materials
+    // of the object. Instances nest up to cu_hit::max_instances deep; deeper
+    // ones are refused.
+    cu_hittable** allocate_instance(cu_hittable** object,
+                                    const aabb& object_box,
+                                    const transform& object_to_world,
+                                    cu_material** mat = nullptr);
+
+    // Packs `spheres` into the compact layout of sphere_cloud.hpp (sorting
+    // them in place). Sphere material indices refer to `materials`.
+    cu_hittable** allocate_sphere_cloud(
+        std::vector<sphere_input>& spheres,
+        const std::vector<cu_material**>& materials);
+
+    // Uploads `mesh` with a hierarchy over its triangles. The mesh is in
+    // world space; place it with allocate_instance to transform it.
+    cu_hittable** allocate_mesh(const triangle_mesh& mesh, cu_material** mat);
+
+    /* Participating medium of constant `density` (per unit length) filling
+     * `boundary`, a closed convex object of another Allocator with bounds
+     * `boundary_box`, and scattering by `phase` (allocate_isotropic). See
+     * cu_medium.hpp.
+     */
+    cu_hittable** allocate_medium(cu_hittable** boundary,
+                                  const aabb& boundary_box, double density,
+                                  cu_material** phase);
+
+    // Heterogeneous medium: `scale` times the densities of `grid`, where
+    // the grid overlaps `boundary`.
+    cu_hittable** allocate_medium(cu_hittable** boundary,
+                                  const aabb& boundary_box,
+                                  const density_grid& grid, double scale,
+                                  cu_material** phase);
+
+    // Makes the opened out-of-core `scene` the world. Renders through
+    // render() then page its bricks in on demand.
+    cu_hittable** allocate_paged_scene(paged_scene& scene);
+
+    // Bounds of everything allocated so far.
+    aabb bounds() const;
+
     cu_material** allocate_metal(const color3 albedo, double fuzz);
 
     cu_material** allocate_lambertian(color3 albedo);
 
+    cu_material** allocate_lambertian(cu_texture** texture);
+
+    // Loads a PPM image into the scene's texture cache, which is created on
+    // first use with `texture_cache_bytes` of device memory.
+    cu_texture** allocate_image_texture(const std::string& path);
+
+    // Marble noise varying along z, `scale` stripes per unit.
+    cu_texture** allocate_noise_texture(double scale, const color3& color);
+
+    // Loads an equirectangular PFM or Radiance HDR image, with its sampling
+    // distribution, for cu_camera::environment.
+    const cu_environment* allocate_environment(const std::string& path);
+
+    /* Empty irradiance cache for cu_camera::irradiance_cache, with cells
+     * about `cell_pixels` pixels wide as seen from the initialised `cam`.
+     * render() fills it in its first pass and reads it afterwards.
+     */
+    cu_irradiance_cache* allocate_irradiance_cache(const cu_camera& cam,
+                                                   double cell_pixels,
+                                                   unsigned int cells = 1u
+                                                                        << 21);
+
     cu_material** allocate_dielectric(double refraction_index);
 
+    // Phase function of media; `albedo` is the fraction scattered.
+    cu_material** allocate_isotropic(const color3 albedo);
+
+    // Changes the parameters of an allocated material in place, see
+    // cu_material::set_params.
+    bool edit_material(cu_material** mat, const color3& albedo, double param);
+
+    // Bit of `mat` in per-pixel material masks, 0 for foreign materials.
+    unsigned long long material_mask(cu_material** mat) const;
+
     void test(cu_camera cam, color3* output);
 
+    // Kernel feature set for rendering this scene through `cam`, with the
+    // optional outputs as requested (see cu_features.hpp).
+    unsigned int render_features(const cu_camera& cam, bool aov,
+                                 bool stats) const;
+
+    // Renders passes into `buffer` until every pixel has
+    // `opts.samples_per_pixel` samples, checkpointing as configured.
+    bool render(cu_camera cam, render_buffer& buffer,
+                const render_options& opts);
+
+    // First hit distance through every pixel center of the initialised
+    // `cam`, inf where the ray escapes and NaN where the hit's shading
+    // depends on the view direction (metal, glass), see temporal.hpp.
+    bool render_depth(const cu_camera& cam, std::vector<float>& depth);
+
+    /* Re-renders the pixels of `buffer` whose paths touched one of the
+     * `edited` materials, to the sample counts they had. Needs the material
+     * masks of the original render (render_buffer::track_materials). Pixels
+     * keep their random streams, so only the edit changes the image.
+     */
+    bool relight(cu_camera cam, render_buffer& buffer,
+                 const std::vector<cu_material**>& edited,
+                 const render_options& opts);
+
+    /* Renders the image pixels (row major indices) `pixels` of `buffer` from
+     * scratch to `opts.samples_per_pixel`, leaving the rest of the image as
+     * it is, e.g. to fix up part of a finished render after a scene change.
+     * The work and device memory follow the size of the region. Pixels use
+     * the random streams of the buffer's seed, as in a full render.
+     */
+    bool render_region(cu_camera cam, render_buffer& buffer,
+                       const std::vector<unsigned int>& pixels,
+                       const render_options& opts);
+
     std::vector<cu_material**> allocated_materials;
     std::vector<cu_hittable**> allocated_hittables;
+    std::vector<aabb> allocated_boxes;  // Host side bounds of the hittables
     cu_hittable** world;
+    paged_scene* pager = nullptr;
+    std::unique_ptr<texture_cache> textures;  // Only with image textures
+    size_t texture_cache_bytes = size_t(256) << 20;
+    unsigned int material_kinds = 0;  // cu_material_kind bits allocated
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "../bvh.hpp"
+#include "cu_hittable.hpp"
+
+class cu_bvh : public cu_hittable {
+   public:
+    // `objects` is in the primitive order of the hierarchy, see build_bvh.
+    __device__ cu_bvh(const bvh_node* nodes, cu_hittable*** objects)
+        : nodes(nodes), objects(objects) {}
+
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node& node = nodes[stack[--top]];
+            if (!node.box.hit(r, interval(ray_t.min, closest_so_far)))
+                continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    if ((*objects[i])->intersect(
+                            r, interval(ray_t.min, closest_so_far), hit)) {
+                        hit_anything = true;
+                        closest_so_far = hit.t;
+                    }
+                }
+            } else {
+                // Push the far child first so the near one is visited first
+                // and shrinks `closest_so_far` early.
+                bool dir_neg = r.direction()[node.axis] < 0;
+                stack[top++] = node.first + (dir_neg ? 0 : 1);
+                stack[top++] = node.first + (dir_neg ? 1 : 0);
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Same traversal without shrinking the interval; the first hit ends it.
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node& node = nodes[stack[--top]];
+            if (!node.box.hit(r, ray_t)) continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++)
+                    if ((*objects[i])->occluded(r, ray_t)) return true;
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+        return false;
+    }
+
+    // The same traversal again, multiplying what the leaves let through.
+    __device__ double transmittance(const ray& r, interval ray_t,
+                                    curandState* rand_state) const override {
+        double passed = 1;
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node& node = nodes[stack[--top]];
+            if (!node.box.hit(r, ray_t)) continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    passed *=
+                        (*objects[i])->transmittance(r, ray_t, rand_state);
+                    if (passed <= 0) return 0;
+                }
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+        return passed;
+    }
+
+    virtual cu_hittable* clone() const override { return new cu_bvh(*this); }
+
+   private:
+    const bvh_node* nodes;
+    cu_hittable*** objects;
+};
@@ -5,7 +5,10 @@
 #include <cstdio>
 
 #include "../common.hpp"
+#include "cu_environment.hpp"
+#include "cu_features.hpp"
 #include "cu_hittable.hpp"
+#include "cu_irradiance_cache.hpp"
 #include "cu_material.hpp"
 
 class cu_camera {
@@ -25,6 +28,18 @@ class cu_camera {
     double defocus_angle = 0.0;
     double focus_distance = 10;
 
+    // Above 0: render an ambient occlusion preview with this radius instead
+    // of tracing paths (see ambient_occlusion).
+    double ao_distance = 0;
+
+    // Lights the scene instead of the sky gradient when set (managed memory,
+    // see Allocator::allocate_environment).
+    const cu_environment* environment = nullptr;
+
+    // Biased shortcut for indirect diffuse light when set (managed memory,
+    // see Allocator::allocate_irradiance_cache and Allocator::render).
+    cu_irradiance_cache* irradiance_cache = nullptr;
+
     cu_camera(){};
     cu_camera(double aspect_ratio, int image_width, double viewport_height,
               double focal_length, int samples_per_pixel)
@@ -47,7 +62,7 @@ class cu_camera {
     vec3 u, v, w;
     vec3 defocus_disk_u;
     vec3 defocus_disk_v;
-    curandStateXORWOW_t rand_state;
+    double pixel_spread;  // Angle subtended by a pixel, for ray footprints
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
@@ -87,33 +102,152 @@ class cu_camera {
             focus_distance * tan(degrees_to_radians(defocus_angle / 2));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
-    };
 
-    __device__ void initRandState() { curand_init(42, 0, 0, &rand_state); }
+        pixel_spread = viewport_height / focus_distance / image_height;
+    };
 
+    // `features` selects what is compiled in, see cu_features.hpp. Their
+    // outputs go to `record`, which they require.
+    template <unsigned int features = default_features>
     __device__ color3 ray_color_iter(const ray& r, const cu_hittable* world,
-                                     int depth) {
+                                     int depth, curandState* rand_state,
+                                     path_record* record = nullptr) {
+        if (features & feature_ao)
+            return ambient_occlusion<features>(r, world, rand_state, record);
+
+        constexpr unsigned int kinds = feature_material_kinds(features);
         color3 output(1, 1, 1);
         ray scattered;
         ray current = r;
         cu_hit_record rec;
         color3 attenuation(0, 0, 0);
+        double travelled = 0;
+        // Light gathered so far and, with an environment, the density of
+        // the last diffuse bounce (0 after other bounces) for MIS on escape.
+        color3 radiance(0, 0, 0);
+        double bounce_pdf = 0;
+        irradiance_path cache_path;  // Filling the irradiance cache
 
         for (int i = 0; i < depth; i++) {
-            if (world->hit(current, interval(0.001, inf), rec)) {
-                rec.mat->scatter(current, rec, attenuation, scattered, &rand_state);
+            if (features & feature_stats) record->rays++;
+            if (world->hit(current, interval(0.001, inf), rec, rand_state)) {
+                // The pixel's cone widens with the path length; texture
+                // lookups pick their mip level from it.
+                travelled += rec.t * current.direction().length();
+                rec.footprint = pixel_spread * travelled;
+                if (features & feature_aov) record->materials |= rec.mat->mask();
+                scatter_material<kinds>(rec.mat, current, rec, attenuation,
+                                        scattered, rand_state);
+                if ((features & feature_aov) && i == 0) {
+                    record->normal = rec.normal;
+                    record->albedo = attenuation;
+                }
+                // First hits are always traced, so the cache only smooths
+                // indirect light.
+                if (irradiance_cache != nullptr &&
+                    rec.mat->kind() == kind_lambertian) {
+                    cu_irradiance_cache* cache = irradiance_cache;
+                    color3 cached;
+                    if (!cache->frozen)
+                        cache_path.add(cache->insert(rec.p, rec.normal),
+                                       output * attenuation, radiance);
+                    else if (i > 0 && cache->lookup(rec.p, rec.normal,
+                                                    rand_state, cached))
+                        return radiance + output * attenuation * cached;
+                }
+                if (environment != nullptr) {
+                    bounce_pdf = 0;
+                    if (rec.mat->kind() == kind_lambertian) {
+                        if (features & feature_stats) record->rays++;
+                        radiance += output * attenuation *
+                                    light_sample(world, rec, rand_state);
+                        bounce_pdf = fmax(0.0, dot(unit_vector(
+                                                       scattered.direction()),
+                                                   rec.normal)) /
+                                     pi;
+                    }
+                }
                 output = output * attenuation;
                 current = scattered;
+            } else if (environment != nullptr) {
+                vec3 direction = current.direction();
+                double weight = 1;
+                if (bounce_pdf > 0)
+                    weight = power_heuristic(bounce_pdf,
+                                             environment->pdf(direction));
+                radiance += weight * output * environment->radiance(direction);
+                break;
             } else {
-                return output * (color3(0.5, 0.7, 1.0));
+                radiance += output * (color3(0.5, 0.7, 1.0));
+                break;
             }
         }
 
-        return color3(0, 0, 0);
+        if (irradiance_cache != nullptr && !irradiance_cache->frozen)
+            cache_path.deposit(irradiance_cache, radiance);
+        return radiance;
+    }
+
+    /* Next event estimation towards the environment from a diffuse hit: one
+     * direction drawn from the environment's distribution, weighted against
+     * the cosine distributed bounce (which picks up the light where the map
+     * is dim) with the power heuristic. Returns the estimate divided by the
+     * albedo, so the caller multiplies in the bounce's attenuation.
+     */
+    __device__ color3 light_sample(const cu_hittable* world,
+                                   const cu_hit_record& rec,
+                                   curandState* rand_state) const {
+        double light_pdf;
+        vec3 direction = environment->sample(rand_state, light_pdf);
+        double cosine = dot(direction, rec.normal);
+        if (light_pdf <= 0 || cosine <= 0) return color3(0, 0, 0);
+        double passed = world->transmittance(ray(rec.p, direction),
+                                             interval(0.001, inf), rand_state);
+        if (passed <= 0) return color3(0, 0, 0);
+
+        double bsdf_pdf = cosine / pi;
+        return environment->radiance(direction) *
+               (passed * power_heuristic(light_pdf, bsdf_pdf) * bsdf_pdf /
+                light_pdf);
+    }
+
+    HD static double power_heuristic(double pdf, double other_pdf) {
+        return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+    }
+
+    /* Clay preview: every surface is a grey diffuse material lit by the sky
+     * color, and one cosine distributed ray per sample tests whether the sky
+     * is visible within `ao_distance`. That is two rays per sample, and the
+     * second only asks whether anything is in the way. Media are left out.
+     */
+    template <unsigned int features>
+    __device__ color3 ambient_occlusion(const ray& r, const cu_hittable* world,
+                                        curandState* rand_state,
+                                        path_record* record) {
+        const color3 clay(0.8, 0.8, 0.8);
+        const color3 sky(0.5, 0.7, 1.0);
+
+        if (features & feature_stats) record->rays++;
+        cu_hit_record rec;
+        if (!world->hit(r, interval(0.001, inf), rec)) return sky;
+
+        if (features & feature_aov) {
+            record->materials |= rec.mat->mask();
+            record->normal = rec.normal;
+            record->albedo = clay;
+        }
+
+        vec3 direction = rec.normal + cu_random_unit_vector(rand_state);
+        if (direction.near_zero()) direction = rec.normal;
+        if (features & feature_stats) record->rays++;
+        if (world->occluded(ray(rec.p, unit_vector(direction)),
+                            interval(0.001, ao_distance)))
+            return color3(0, 0, 0);
+        return clay * sky;
     }
 
     __device__ color3 ray_color(const ray& r, const cu_hittable* world,
-                                int depth) {
+                                int depth, curandState* rand_state) {
         // printf("ray_color depth: %d\n", depth);
         if (depth <= 0) return color3(0, 0, 0);
 
@@ -121,8 +255,9 @@ class cu_camera {
         if (world->hit(r, interval(0.001, inf), rec)) {
             ray scattered;
             color3 attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered, &rand_state))
-                return attenuation * ray_color(scattered, world, depth - 1);
+            if (rec.mat->scatter(r, rec, attenuation, scattered, rand_state))
+                return attenuation *
+                       ray_color(scattered, world, depth - 1, rand_state);
 
             return color3(0, 0, 0);
         }
@@ -132,33 +267,34 @@ class cu_camera {
         return (1.0 - a) * color3(1.0, 1.0, 1.0) + a * color3(0.5, 0.7, 1.0);
     }
 
-    __device__ ray get_ray(int i, int j) {
+    template <unsigned int features = default_features>
+    __device__ ray get_ray(int i, int j, curandState* rand_state) {
         // Construct a camera ray originating from the origin and directed at
         // randomly sampled point around the pixel location i, j.
 
-        auto offset = sample_square();
+        auto offset = sample_square(rand_state);
         auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) +
                             ((j + offset.y()) * pixel_delta_v);
 
-        // auto ray_origin = defocus_angle <= 0 ? center :
-        // defocus_disk_sample();
-        auto ray_origin = center;
+        auto ray_origin = (features & feature_defocus)
+                              ? defocus_disk_sample(rand_state)
+                              : center;
         auto ray_direction = pixel_sample - ray_origin;
 
         return ray(ray_origin, ray_direction);
     };
 
-    __device__ point3 defocus_disk_sample() {
+    __device__ point3 defocus_disk_sample(curandState* rand_state) {
         // Returns a random point in the camera defocus disk.
-        auto p = cu_random_in_unit_disk(&rand_state);
+        auto p = cu_random_in_unit_disk(rand_state);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     };
 
-    __device__ vec3 sample_square() {
+    __device__ vec3 sample_square(curandState* rand_state) {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit
         // square.
-        return vec3(curand_uniform_double(&rand_state) - 0.5,
-                    curand_uniform_double(&rand_state) - 0.5, 0);
+        return vec3(curand_uniform_double(rand_state) - 0.5,
+                    curand_uniform_double(rand_state) - 0.5, 0);
     }
 
     cu_camera* clone() { return new cu_camera(*this); }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <curand_kernel.h>
+#include <curand_uniform.h>
+
+#include "../common.hpp"
+
+/* Equirectangular HDR environment in managed memory, built from an
+ * environment_map (see environment.hpp). Directions map to the image with +y
+ * at the top row and the azimuth atan2(z, x) running across it; radiance is
+ * constant over a texel, as is the sampling density, so sample() and pdf()
+ * agree exactly.
+ */
+class cu_environment {
+   public:
+    int width, height;
+    const float* rgb;         // Linear RGB, rows from the top
+    const float* row_cdf;     // height + 1
+    const float* column_cdf;  // height * (width + 1)
+
+    __device__ color3 radiance(const vec3& direction) const {
+        int x, y;
+        texel_of(direction, x, y);
+        const float* p = &rgb[(size_t(y) * width + x) * 3];
+        return color3(p[0], p[1], p[2]);
+    }
+
+    // Picks a unit direction in proportion to the radiance; `pdf` is per
+    // solid angle.
+    __device__ vec3 sample(curandState* rand_state, double& pdf) const {
+        double u1 = 1 - curand_uniform_double(rand_state);
+        double u2 = 1 - curand_uniform_double(rand_state);
+
+        int y = find_interval(row_cdf, height, u1);
+        double row_p = row_cdf[y + 1] - row_cdf[y];
+        const float* columns = column_cdf + size_t(y) * (width + 1);
+        int x = find_interval(columns, width, u2);
+        double column_p = columns[x + 1] - columns[x];
+
+        // Uniform within the texel.
+        double v = (y + (u1 - row_cdf[y]) / fmax(row_p, 1e-12)) / height;
+        double u = (x + (u2 - columns[x]) / fmax(column_p, 1e-12)) / width;
+        double theta = fmin(fmax(v, 0.0), 1.0) * pi;
+        double phi = 2 * pi * u - pi;
+        double sin_theta = sin(theta);
+
+        pdf = sin_theta > 0 ? row_p * column_p * width * height /
+                                  (2 * pi * pi * sin_theta)
+                            : 0;
+        return vec3(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+    }
+
+    // Density of sample() at `direction`, per solid angle.
+    __device__ double pdf(const vec3& direction) const {
+        vec3 d = unit_vector(direction);
+        double sin_theta = sqrt(fmax(0.0, 1 - d.y() * d.y()));
+        if (sin_theta <= 0) return 0;
+
+        int x, y;
+        texel_of(d, x, y);
+        const float* columns = column_cdf + size_t(y) * (width + 1);
+        double p = double(row_cdf[y + 1] - row_cdf[y]) *
+                   (columns[x + 1] - columns[x]);
+        return p * width * height / (2 * pi * pi * sin_theta);
+    }
+
+   private:
+    __device__ void texel_of(const vec3& direction, int& x, int& y) const {
+        vec3 d = unit_vector(direction);
+        double v = acos(fmin(fmax(d.y(), -1.0), 1.0)) / pi;
+        double u = (atan2(d.z(), d.x()) + pi) / (2 * pi);
+        x = min(int(u * width), width - 1);
+        y = min(int(v * height), height - 1);
+    }
+
+    // Index i with cdf[i] <= u < cdf[i + 1], for u in [0, 1).
+    __device__ static int find_interval(const float* cdf, int n, double u) {
+        int lo = 0, hi = n;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] <= u)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+};
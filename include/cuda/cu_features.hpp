@@ -0,0 +1,122 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include "cu_material.hpp"
+
+/* Render kernels are instantiated per feature set, so that disabled features
+ * compile out of the sample loop instead of being tested per sample. The set
+ * is chosen once per render (Allocator::render_features).
+ *
+ * Every bit doubles the kernels of every launch site, so only features that
+ * are cheap to test but costly to compile in get one. The environment light
+ * and the irradiance cache are tested per bounce through the camera's
+ * pointers instead.
+ */
+enum render_feature : unsigned int {
+    feature_defocus = 1,  // Thin lens depth of field
+    feature_aov = 2,      // First hit normal and albedo, material masks
+    feature_stats = 4,    // Ray counts
+    feature_ao = 64,      // Ambient occlusion preview instead of paths
+};
+
+// Bits 3 to 5 hold the cu_material_kind bits of the materials in the scene.
+// Media are rare enough that their isotropic phase function has no bit and
+// always scatters through the virtual call.
+constexpr unsigned int feature_material_shift = 3;
+constexpr unsigned int feature_sets = 128;
+constexpr unsigned int all_material_kinds =
+    kind_lambertian | kind_metal | kind_dielectric;
+
+HD constexpr unsigned int feature_material_kinds(unsigned int features) {
+    return (features >> feature_material_shift) & all_material_kinds;
+}
+
+/* Sets render_features can return: paths need at least one material kind,
+ * previews ignore materials. Only these are instantiated.
+ */
+HD constexpr bool feature_set_used(unsigned int features) {
+    return (features & feature_ao) ? feature_material_kinds(features) == 0
+                                   : feature_material_kinds(features) != 0;
+}
+
+// The features of the plain render loop: any material, nothing else.
+constexpr unsigned int default_features = all_material_kinds
+                                          << feature_material_shift;
+
+/* Scatters off `mat` without a virtual call when its kind is one of `kinds`;
+ * the kinds absent from the scene are compiled out. Materials of other kinds
+ * (e.g. of instanced objects built by another Allocator) still work through
+ * the virtual call.
+ */
+template <unsigned int kinds>
+__device__ inline bool scatter_material(const cu_material* mat,
+                                        const ray& r_in,
+                                        const cu_hit_record& rec,
+                                        color3& attenuation, ray& scattered,
+                                        curandState* rand_state) {
+    const cu_material_kind kind = mat->kind();
+    if ((kinds & kind_lambertian) && kind == kind_lambertian)
+        return static_cast<const cu_lambertian*>(mat)->cu_lambertian::scatter(
+            r_in, rec, attenuation, scattered, rand_state);
+    if ((kinds & kind_metal) && kind == kind_metal)
+        return static_cast<const cu_metal*>(mat)->cu_metal::scatter(
+            r_in, rec, attenuation, scattered, rand_state);
+    if ((kinds & kind_dielectric) && kind == kind_dielectric)
+        return static_cast<const cu_dielectric*>(mat)->cu_dielectric::scatter(
+            r_in, rec, attenuation, scattered, rand_state);
+    return mat->scatter(r_in, rec, attenuation, scattered, rand_state);
+}
+
+// Per sample outputs of the optional features.
+struct path_record {
+    vec3 normal = vec3(0, 0, 0);      // First hit (feature_aov)
+    color3 albedo = color3(0, 0, 0);  // First hit attenuation (feature_aov)
+    unsigned long long materials = 0;  // Materials hit (feature_aov)
+    unsigned int rays = 0;             // Rays traced (feature_stats)
+};
+
+/* Calls `launch(std::integral_constant<unsigned int, F>())` with F equal to
+ * `features`, turning the runtime feature set into a template argument.
+ * Returns false, launching nothing, for sets without a kernel: the bits of
+ * unknown features and the sets feature_set_used rules out.
+ *
+ * A table indexed by the set, rather than a chain of comparisons, so that
+ * neither the instantiation depth nor the dispatch cost grows with the number
+ * of sets. Only the used sets get an entry that instantiates `launch`.
+ */
+template <class Launch>
+struct feature_dispatch {
+    using entry = void (*)(Launch&);
+
+    template <unsigned int F>
+    static void call(Launch& launch) {
+        launch(std::integral_constant<unsigned int, F>());
+    }
+
+    template <unsigned int F>
+    static constexpr entry at() {
+        if constexpr (feature_set_used(F))
+            return &call<F>;
+        else
+            return nullptr;
+    }
+
+    template <unsigned int... F>
+    static bool run(unsigned int features, Launch& launch,
+                    std::integer_sequence<unsigned int, F...>) {
+        static constexpr entry table[] = {at<F>()...};
+        if (features >= sizeof...(F) || table[features] == nullptr)
+            return false;
+        table[features](launch);
+        return true;
+    }
+};
+
+template <class Launch>
+bool dispatch_features(unsigned int features, Launch launch) {
+    return feature_dispatch<Launch>::run(
+        features, launch,
+        std::make_integer_sequence<unsigned int, feature_sets>());
+}
@@ -12,6 +12,14 @@ class cu_hit_record {
     double t;
     bool front_face;
 
+    // Surface coordinates for textures; `uv_per_unit` is the rate at which
+    // they change per unit of distance along the surface, 0 when the
+    // primitive has none.
+    double u = 0, v = 0;
+    double uv_per_unit = 0;
+    // Width of the ray (cone) at the hit, set by the camera.
+    double footprint = 0;
+
     HD cu_hit_record() {};
 
     /* Sets the hit record normal vector.
@@ -21,12 +29,95 @@ class cu_hit_record {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // Latitude-longitude coordinates of a sphere of `radius`, from the unit
+    // `outward_normal`; v runs from 0 at the bottom (-y) to 1 at the top.
+    HD void set_sphere_uv(const vec3& outward_normal, double radius) {
+        double theta = acos(-outward_normal.y());
+        double phi = atan2(-outward_normal.z(), outward_normal.x()) + pi;
+        u = phi / (2 * pi);
+        v = theta / pi;
+        uv_per_unit = 1 / (pi * radius);
+    }
+};
+
+class cu_hittable;
+
+/* Nearest hit of a ray as found by traversal (cu_hittable::intersect): only
+ * its distance and what is needed to compute the surface data afterwards,
+ * which is the primitive object that finalizes it, the primitive's own
+ * `index` and `coords` (e.g. a triangle and its barycentrics) and the
+ * instances the ray passed through on the way, innermost first. Media sample
+ * their collisions with `rand_state` and let rays through without one.
+ */
+struct cu_hit {
+    static constexpr int max_instances = 4;
+
+    double t;
+    const cu_hittable* prim;
+    int index;
+    double coords[2];
+    const cu_hittable* instances[max_instances];
+    int instance_count;
+    curandState* rand_state = nullptr;
 };
 
 class cu_hittable {
    public:
-    __device__ virtual bool hit(const ray& r, interval ray_t,
-                                cu_hit_record& rec) const = 0;
+    /* Finds the nearest hit within `ray_t` and stores it in `hit`, which is
+     * left alone when there is none. Candidates only record where they are:
+     * the surface data of the one that ends up nearest is computed once, by
+     * finalize(). Primitives reset `hit.instance_count` on every candidate.
+     */
+    __device__ virtual bool intersect(const ray& r, interval ray_t,
+                                      cu_hit& hit) const = 0;
+
+    /* Fills in `rec` for a hit found by this primitive's intersect(); `r` is
+     * the ray in the primitive's space. Objects that only hold other objects
+     * never finalize.
+     */
+    __device__ virtual void finalize(const ray& r, const cu_hit& hit,
+                                     cu_hit_record& rec) const {}
+
+    // Both phases: the nearest hit within `ray_t` with its surface data.
+    __device__ bool hit(const ray& r, interval ray_t, cu_hit_record& rec,
+                        curandState* rand_state = nullptr) const {
+        cu_hit h;
+        h.rand_state = rand_state;
+        if (!intersect(r, ray_t, h)) return false;
+
+        ray local = r;
+        for (int k = h.instance_count - 1; k >= 0; k--)
+            local = h.instances[k]->to_object(local);
+        rec.t = h.t;
+        h.prim->finalize(local, h, rec);
+        for (int k = 0; k < h.instance_count; k++)
+            h.instances[k]->to_world(rec);
+        return true;
+    }
+
+    /* Any-hit query: whether anything is hit within `ray_t`. Implementations
+     * return at the first intersection they find, in any order, and skip
+     * the surface data; this fallback is only as fast as intersect().
+     */
+    __device__ virtual bool occluded(const ray& r, interval ray_t) const {
+        cu_hit h;
+        return intersect(r, ray_t, h);
+    }
+
+    /* Fraction of light that gets through within `ray_t`, for shadow rays:
+     * 0 behind a surface, less than 1 through media, which estimate it with
+     * `rand_state`. Any-hit queries (occluded) see through media instead.
+     */
+    __device__ virtual double transmittance(const ray& r, interval ray_t,
+                                            curandState* rand_state) const {
+        return occluded(r, ray_t) ? 0 : 1;
+    }
+
+    // Moves rays into and hit records out of the space of an instance (see
+    // cu_instance); other objects live in world space.
+    __device__ virtual ray to_object(const ray& r) const { return r; }
+    __device__ virtual void to_world(cu_hit_record& rec) const {}
 
     virtual cu_hittable* clone() const = 0;
 };
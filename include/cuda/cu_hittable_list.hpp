@@ -15,31 +15,36 @@ class cu_hittable_list : public cu_hittable {
         num_objects = d_num_objects;
     }
 
-    __device__ bool hit(const ray &r, interval ray_t,
-                cu_hit_record &rec) const override {
-        // printf("-> list hit\n");
-        cu_hit_record temp_rec;
+    __device__ bool intersect(const ray &r, interval ray_t,
+                              cu_hit &hit) const override {
         bool hit_anything = false;
-
         double closest_so_far = ray_t.max;
 
-        // printf("pre-loop\n");
         for (int i = 0; i < num_objects; i++) {
-            // printf("Object: %d\n", i);
-            cu_hittable **object = objects[i];
-
-            // printf("obj-ref\n");
-            if ((*object)->hit(r, interval(ray_t.min, closest_so_far),
-                               temp_rec)) {
+            if ((*objects[i])->intersect(r, interval(ray_t.min, closest_so_far),
+                                         hit)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = hit.t;
             }
         }
 
         return hit_anything;
     }
 
+    __device__ bool occluded(const ray &r, interval ray_t) const override {
+        for (int i = 0; i < num_objects; i++)
+            if ((*objects[i])->occluded(r, ray_t)) return true;
+        return false;
+    }
+
+    __device__ double transmittance(const ray &r, interval ray_t,
+                                    curandState *rand_state) const override {
+        double passed = 1;
+        for (int i = 0; i < num_objects && passed > 0; i++)
+            passed *= (*objects[i])->transmittance(r, ray_t, rand_state);
+        return passed;
+    }
+
     virtual cu_hittable *clone() const override {
         return new cu_hittable_list(*this);
     }
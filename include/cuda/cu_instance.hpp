@@ -0,0 +1,62 @@
+#pragma once
+
+#include "../transform.hpp"
+#include "cu_hittable.hpp"
+
+/* Places a shared object (usually the hierarchy of a whole sub-scene) into the
+ * world through an affine transform. Rays are moved into object space instead
+ * of copying the geometry, so every copy costs one instance. The direction is
+ * not renormalised, which keeps the hit distance `t` valid in both spaces.
+ */
+class cu_instance : public cu_hittable {
+   public:
+    __device__ cu_instance(cu_hittable** object,
+                           const transform& object_to_world,
+                           const transform& world_to_object, cu_material* mat)
+        : object(object),
+          object_to_world(object_to_world),
+          world_to_object(world_to_object),
+          mat(mat) {}
+
+    // Records the instance on the way out of a hit inside it. Instances
+    // nest up to cu_hit::max_instances deep; further out ones are dropped.
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        if (!(*object)->intersect(to_object(r), ray_t, hit)) return false;
+        if (hit.instance_count < cu_hit::max_instances)
+            hit.instances[hit.instance_count++] = this;
+        return true;
+    }
+
+    __device__ ray to_object(const ray& r) const override {
+        return ray(world_to_object.apply_point(r.origin()),
+                   world_to_object.apply_vector(r.direction()));
+    }
+
+    // Normals transform with the inverse transpose. This keeps the sign of
+    // dot(direction, normal), so front_face carries over unchanged.
+    __device__ void to_world(cu_hit_record& rec) const override {
+        rec.p = object_to_world.apply_point(rec.p);
+        rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+        if (mat != nullptr) rec.mat = mat;
+    }
+
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        return (*object)->occluded(to_object(r), ray_t);
+    }
+
+    __device__ double transmittance(const ray& r, interval ray_t,
+                                    curandState* rand_state) const override {
+        return (*object)->transmittance(to_object(r), ray_t, rand_state);
+    }
+
+    virtual cu_hittable* clone() const override {
+        return new cu_instance(*this);
+    }
+
+   private:
+    cu_hittable** object;
+    transform object_to_world;
+    transform world_to_object;
+    cu_material* mat;  // Overrides the object's materials unless null
+};
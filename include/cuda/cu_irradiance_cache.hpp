@@ -0,0 +1,140 @@
+#pragma once
+
+#include <curand_kernel.h>
+#include <curand_uniform.h>
+
+#include "../common.hpp"
+
+struct irradiance_cell {
+    unsigned long long key;  // 0: empty
+    float sum[3];
+    unsigned int count;
+};
+
+/* World space cache of indirect diffuse light, as outgoing radiance over
+ * albedo, in a hash table of grid cells (after Binder et al., "Fast Path
+ * Space Filtering by Jittered Spatial Hashing"). Cells are cubes whose size is
+ * a power of two close to `cell_pixels` pixel footprints at their distance
+ * from the eye, which bounds the interpolation error on screen; cells also
+ * split by a coarse quantisation of the normal so that corners do not mix.
+ *
+ * The cache is filled first (`frozen` 0): every diffuse vertex of a path adds
+ * the light the rest of the path gathered to its cell, with atomics, claiming
+ * cells with compare-and-swap. Once frozen it is read only, and lookups
+ * jitter the position by up to a cell, which blends neighbouring cells over
+ * the samples of a pixel instead of showing the grid. Cells with fewer than
+ * `min_samples` estimates are ignored. Paths ending in the cache are biased:
+ * detail smaller than a cell is lost from indirect light.
+ */
+class cu_irradiance_cache {
+   public:
+    irradiance_cell* cells;
+    unsigned int capacity;  // Power of two
+    point3 eye;
+    double cell_scale;  // Cell size per unit of distance from the eye
+    unsigned int min_samples = 16;
+    int frozen = 0;
+
+    // Cell of a hit, claimed if new; -1 when the probe sequence is full.
+    __device__ int insert(const point3& p, const vec3& normal) {
+        unsigned long long k = key(p, normal, level(p));
+        for (unsigned int probe = 0; probe < max_probes; probe++) {
+            unsigned int slot = (unsigned int)(k + probe) & (capacity - 1);
+            unsigned long long seen = atomicCAS(&cells[slot].key, 0ull, k);
+            if (seen == 0 || seen == k) return int(slot);
+        }
+        return -1;
+    }
+
+    __device__ void add(int slot, const color3& value) {
+        irradiance_cell& cell = cells[slot];
+        atomicAdd(&cell.sum[0], float(value.x()));
+        atomicAdd(&cell.sum[1], float(value.y()));
+        atomicAdd(&cell.sum[2], float(value.z()));
+        atomicAdd(&cell.count, 1u);
+    }
+
+    __device__ bool lookup(const point3& p, const vec3& normal,
+                           curandState* rand_state, color3& value) const {
+        int l = level(p);
+        double size = exp2(double(l));
+        point3 jittered =
+            p + size * vec3(curand_uniform_double(rand_state) - 0.5,
+                            curand_uniform_double(rand_state) - 0.5,
+                            curand_uniform_double(rand_state) - 0.5);
+        unsigned long long k = key(jittered, normal, l);
+        for (unsigned int probe = 0; probe < max_probes; probe++) {
+            const irradiance_cell& cell =
+                cells[(unsigned int)(k + probe) & (capacity - 1)];
+            if (cell.key == 0) return false;
+            if (cell.key != k) continue;
+            if (cell.count < min_samples) return false;
+            value = color3(cell.sum[0], cell.sum[1], cell.sum[2]) / cell.count;
+            return true;
+        }
+        return false;
+    }
+
+   private:
+    static constexpr unsigned int max_probes = 16;
+
+    __device__ int level(const point3& p) const {
+        double size = fmax(cell_scale * (p - eye).length(), 1e-6);
+        return int(ceil(log2(size)));
+    }
+
+    __device__ static unsigned long long mix(unsigned long long h,
+                                             long long v) {
+        h ^= (unsigned long long)v + 0x9e3779b97f4a7c15ull + (h << 6) +
+             (h >> 2);
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        return h;
+    }
+
+    __device__ static unsigned long long key(const point3& p,
+                                             const vec3& normal, int level) {
+        double inv = exp2(double(-level));
+        unsigned long long h = mix(0, level);
+        for (int axis = 0; axis < 3; axis++) {
+            h = mix(h, (long long)floor(p[axis] * inv));
+            h = mix(h, (long long)lround(normal[axis]));  // -1, 0 or 1
+        }
+        return h | 1;  // Never the empty key
+    }
+};
+
+/* The diffuse vertices of one path while the cache fills: where they are,
+ * the path throughput including their albedo, and the light gathered before
+ * them. Whatever the path gathers afterwards, divided by that throughput, is
+ * the vertex's estimate.
+ */
+struct irradiance_path {
+    static constexpr int max_vertices = 4;
+    int slots[max_vertices];
+    color3 throughput[max_vertices];
+    color3 gathered[max_vertices];
+    int count = 0;
+
+    __device__ void add(int slot, const color3& path_throughput,
+                        const color3& gathered_before) {
+        if (slot < 0 || count == max_vertices) return;
+        slots[count] = slot;
+        throughput[count] = path_throughput;
+        gathered[count] = gathered_before;
+        count++;
+    }
+
+    __device__ void deposit(cu_irradiance_cache* cache,
+                            const color3& total) const {
+        for (int k = 0; k < count; k++) {
+            const color3& t = throughput[k];
+            // Nearly black throughput would blow the estimate up.
+            if (t.x() < 1e-3 || t.y() < 1e-3 || t.z() < 1e-3) continue;
+            color3 after = total - gathered[k];
+            cache->add(slots[k], color3(after.x() / t.x(), after.y() / t.y(),
+                                        after.z() / t.z()));
+        }
+    }
+};
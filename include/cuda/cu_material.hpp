@@ -6,23 +6,57 @@
 
 #include "../common.hpp"
 #include "cu_hittable.hpp"
+#include "cu_texture.hpp"
+
+// Concrete material classes, as bits so that sets of them fit a mask.
+enum cu_material_kind : unsigned int {
+    kind_lambertian = 1,
+    kind_metal = 2,
+    kind_dielectric = 4,
+    kind_isotropic = 8,
+};
 
 class cu_material {
    public:
+    HD explicit cu_material(cu_material_kind kind) : kind_bit(kind) {}
     HD virtual ~cu_material() = default;
 
+    HD cu_material_kind kind() const { return kind_bit; }
+
     __device__ virtual bool scatter(const ray& r_in, const cu_hit_record& rec,
                                     color3& attenuation, ray& scattered,
                                     curandState* rand_state) const {
         return false;
     }
 
+    /* Replaces the parameters of the material in place, for look development
+     * edits. `param` is the fuzz of metals and the refraction index of
+     * dielectrics; isotropic media ignore it.
+     */
+    __device__ virtual void set_params(const color3& albedo, double param) {}
+
+    // Bit of the material in per-pixel material masks. Materials share bits
+    // when there are more than 64 of them, which only makes masks coarser.
+    HD unsigned long long mask() const { return mask_bit; }
+    HD void set_id(int id) { mask_bit = 1ull << (id % 64); }
+
     virtual cu_material* clone() const = 0;
+
+   private:
+    cu_material_kind kind_bit;
+    unsigned long long mask_bit = 0;
 };
 
 class cu_lambertian : public cu_material {
    public:
-    HD cu_lambertian(const color3& albedo) : albedo(albedo) {}
+    HD cu_lambertian(const color3& albedo)
+        : cu_material(kind_lambertian), albedo(albedo) {}
+
+    // Textured; `albedo` then tints the texture.
+    HD cu_lambertian(const cu_texture* texture)
+        : cu_material(kind_lambertian),
+          albedo(color3(1, 1, 1)),
+          texture(texture) {}
 
     __device__ virtual bool scatter(const ray& r_in, const cu_hit_record& rec,
                                     color3& attenuation, ray& scattered,
@@ -32,21 +66,28 @@ class cu_lambertian : public cu_material {
 
         scattered = ray(rec.p, scatter_direction);
         attenuation = albedo;
+        if (texture != nullptr)
+            attenuation = attenuation * texture->value(rec, rand_state);
         return true;
     }
 
+    __device__ void set_params(const color3& albedo, double) override {
+        this->albedo = albedo;
+    }
+
     virtual cu_material* clone() const override {
         return new cu_lambertian(*this);
     }
 
    private:
     color3 albedo;
+    const cu_texture* texture = nullptr;
 };
 
 class cu_metal : public cu_material {
    public:
     HD cu_metal(const color3& albedo, double fuzz)
-        : albedo(albedo), fuzz(fuzz) {}
+        : cu_material(kind_metal), albedo(albedo), fuzz(fuzz) {}
 
     __device__ virtual bool scatter(const ray& r_in, const cu_hit_record& rec,
                                     color3& attenuation, ray& scattered,
@@ -59,6 +100,11 @@ class cu_metal : public cu_material {
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    __device__ void set_params(const color3& albedo, double fuzz) override {
+        this->albedo = albedo;
+        this->fuzz = fuzz;
+    }
+
     virtual cu_material* clone() const override { return new cu_metal(*this); }
 
    private:
@@ -69,7 +115,7 @@ class cu_metal : public cu_material {
 class cu_dielectric : public cu_material {
    public:
     HD cu_dielectric(double refraction_index)
-        : refraction_index(refraction_index) {}
+        : cu_material(kind_dielectric), refraction_index(refraction_index) {}
 
     __device__ bool scatter(const ray& r_in, const cu_hit_record& rec,
                             color3& attenuation, ray& scattered,
@@ -95,6 +141,10 @@ class cu_dielectric : public cu_material {
         return true;
     }
 
+    __device__ void set_params(const color3&, double refraction_index) override {
+        this->refraction_index = refraction_index;
+    }
+
     virtual cu_material* clone() const override {
         return new cu_dielectric(*this);
     }
@@ -111,3 +161,32 @@ class cu_dielectric : public cu_material {
         return r0 + (1 - r0) * pow((1 - cosine), 5);
     }
 };
+
+/* Phase function of participating media (see cu_medium): scatters into a
+ * uniformly random direction whatever the incoming one, keeping `albedo` of
+ * the light.
+ */
+class cu_isotropic : public cu_material {
+   public:
+    HD cu_isotropic(const color3& albedo)
+        : cu_material(kind_isotropic), albedo(albedo) {}
+
+    __device__ bool scatter(const ray& r_in, const cu_hit_record& rec,
+                            color3& attenuation, ray& scattered,
+                            curandState* rand_state) const override {
+        scattered = ray(rec.p, cu_random_unit_vector(rand_state));
+        attenuation = albedo;
+        return true;
+    }
+
+    __device__ void set_params(const color3& albedo, double) override {
+        this->albedo = albedo;
+    }
+
+    virtual cu_material* clone() const override {
+        return new cu_isotropic(*this);
+    }
+
+   private:
+    color3 albedo;
+};
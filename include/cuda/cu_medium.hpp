@@ -0,0 +1,237 @@
+#pragma once
+
+#include <curand_kernel.h>
+
+#include "../aabb.hpp"
+#include "cu_hittable.hpp"
+
+/* Device view of a density_grid and its majorant_grid (see volume.hpp), in
+ * managed memory.
+ */
+struct cu_density_grid {
+    int nx = 0, ny = 0, nz = 0;
+    const float* density = nullptr;  // Null: no grid
+    aabb bounds;
+    vec3 voxel;  // Size of a voxel
+    int block = 0;
+    int mx = 0, my = 0, mz = 0;
+    const float* majorant = nullptr;
+
+    // Trilinear interpolation between voxel centers, clamped at the faces.
+    __device__ double lookup(const point3& p) const {
+        double g[3];
+        int i[3];
+        for (int a = 0; a < 3; a++) {
+            g[a] = (p[a] - bounds.axis_interval(a).min) / voxel[a] - 0.5;
+            i[a] = int(floor(g[a]));
+            g[a] -= i[a];
+        }
+
+        double value = 0;
+        for (int k = 0; k < 8; k++) {
+            int x = clamp(i[0] + (k & 1), nx);
+            int y = clamp(i[1] + (k >> 1 & 1), ny);
+            int z = clamp(i[2] + (k >> 2), nz);
+            double w = ((k & 1) ? g[0] : 1 - g[0]) *
+                       ((k >> 1 & 1) ? g[1] : 1 - g[1]) *
+                       ((k >> 2) ? g[2] : 1 - g[2]);
+            value += w * density[(size_t(z) * ny + y) * nx + x];
+        }
+        return value;
+    }
+
+    /* Walks the majorant blocks that `r` crosses between `t0` and `t1` (which
+     * lie inside the bounds) in order, calling `visit(t_in, t_out,
+     * majorant)` for each until it returns false.
+     */
+    template <class Visit>
+    __device__ void march(const ray& r, double t0, double t1,
+                          Visit visit) const {
+        const int n[3] = {mx, my, mz};
+        const point3 p = r.at(t0);
+        int cell[3], step[3];
+        double next[3], delta[3];
+        for (int a = 0; a < 3; a++) {
+            const double size = voxel[a] * block;
+            const double offset = p[a] - bounds.axis_interval(a).min;
+            const double d = r.direction()[a];
+            cell[a] = min(max(int(floor(offset / size)), 0), n[a] - 1);
+            step[a] = d > 0 ? 1 : (d < 0 ? -1 : 0);
+            next[a] = inf;
+            delta[a] = inf;
+            if (d != 0) {
+                next[a] = t0 + ((cell[a] + (d > 0)) * size - offset) / d;
+                delta[a] = size / fabs(d);
+            }
+        }
+
+        double t = t0;
+        while (t < t1) {
+            int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                                      : (next[1] < next[2] ? 1 : 2);
+            double end = fmin(next[a], t1);
+            if (!visit(t, end,
+                       majorant[(size_t(cell[2]) * my + cell[1]) * mx +
+                                cell[0]]))
+                return;
+            t = end;
+            cell[a] += step[a];
+            if (cell[a] < 0 || cell[a] >= n[a]) return;
+            next[a] += delta[a];
+        }
+    }
+
+   private:
+    __device__ static int clamp(int i, int n) { return min(max(i, 0), n - 1); }
+};
+
+/* Participating medium filling the inside of `boundary`, which must be
+ * closed and convex (a ray enters and leaves it once), e.g. a sphere.
+ * Light travelling through it scatters with probability density per unit
+ * length `density`, or `density` times the grid's interpolated value for
+ * heterogeneous media, and scatters by the phase function `phase` (usually
+ * cu_isotropic).
+ *
+ * intersect() samples where a ray first collides with the medium. Constant
+ * density has a closed form. Grids use delta tracking against the majorant
+ * of each block the ray crosses: tentative collisions at the majorant's rate
+ * are accepted in proportion to the actual density, and blocks of empty
+ * space (majorant 0) are stepped over without sampling. Shadow rays estimate
+ * transmittance by ratio tracking over the same blocks.
+ */
+class cu_medium : public cu_hittable {
+   public:
+    __device__ cu_medium(cu_hittable** boundary, double density,
+                         cu_material* phase)
+        : boundary(boundary), density(density), phase(phase) {}
+
+    // Heterogeneous; the medium is the part of the boundary inside the grid.
+    __device__ cu_medium(cu_hittable** boundary, const cu_density_grid& grid,
+                         double scale, cu_material* phase)
+        : boundary(boundary), grid(grid), density(scale), phase(phase) {}
+
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        if (hit.rand_state == nullptr) return false;
+        interval inside;
+        if (!extent(r, ray_t, inside)) return false;
+
+        curandState* rand_state = hit.rand_state;
+        const double length = r.direction().length();
+        double collision = inf;
+        if (grid.density == nullptr) {
+            double t = inside.min - log(curand_uniform_double(rand_state)) /
+                                        (density * length);
+            if (t < inside.max) collision = t;
+        } else {
+            grid.march(r, inside.min, inside.max,
+                       [&](double t0, double t1, float majorant) {
+                           double rate = density * majorant * length;
+                           if (rate <= 0) return true;
+                           for (double t = t0;;) {
+                               t -= log(curand_uniform_double(rand_state)) /
+                                    rate;
+                               if (t >= t1) return true;
+                               if (curand_uniform_double(rand_state) *
+                                       majorant <=
+                                   grid.lookup(r.at(t))) {
+                                   collision = t;
+                                   return false;
+                               }
+                           }
+                       });
+        }
+        if (collision == inf) return false;
+
+        hit.t = collision;
+        hit.prim = this;
+        hit.instance_count = 0;
+        return true;
+    }
+
+    // Collisions have no surface; the normal faces back along the ray.
+    __device__ void finalize(const ray& r, const cu_hit& hit,
+                             cu_hit_record& rec) const override {
+        rec.p = r.at(hit.t);
+        rec.set_face_normal(r, -unit_vector(r.direction()));
+        rec.mat = phase;
+        rec.u = rec.v = 0;
+        rec.uv_per_unit = 0;
+    }
+
+    // Any-hit queries (ambient occlusion) look through media.
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        return false;
+    }
+
+    __device__ double transmittance(const ray& r, interval ray_t,
+                                    curandState* rand_state) const override {
+        interval inside;
+        if (!extent(r, ray_t, inside)) return 1;
+
+        const double length = r.direction().length();
+        if (grid.density == nullptr)
+            return exp(-density * length * inside.size());
+
+        // Ratio tracking, with Russian roulette once little gets through.
+        double passed = 1;
+        grid.march(r, inside.min, inside.max,
+                   [&](double t0, double t1, float majorant) {
+                       double rate = density * majorant * length;
+                       if (rate <= 0) return true;
+                       for (double t = t0;;) {
+                           t -= log(curand_uniform_double(rand_state)) / rate;
+                           if (t >= t1) return true;
+                           passed *= 1 - grid.lookup(r.at(t)) / majorant;
+                           if (passed < 0.1) {
+                               if (curand_uniform_double(rand_state) > 0.5) {
+                                   passed = 0;
+                                   return false;
+                               }
+                               passed *= 2;
+                           }
+                       }
+                   });
+        return passed;
+    }
+
+    virtual cu_hittable* clone() const override {
+        return new cu_medium(*this);
+    }
+
+   private:
+    cu_hittable** boundary;
+    cu_density_grid grid;
+    double density;  // Constant density, or the scale of the grid's
+    cu_material* phase;
+
+    // Part of `ray_t` inside the boundary (and the grid).
+    __device__ bool extent(const ray& r, interval ray_t,
+                           interval& inside) const {
+        cu_hit enter, leave;
+        if (!(*boundary)->intersect(r, interval(-inf, inf), enter) ||
+            !(*boundary)->intersect(r, interval(enter.t + 0.0001, inf), leave))
+            return false;
+        inside = interval(fmax(enter.t, ray_t.min), fmin(leave.t, ray_t.max));
+
+        if (grid.density != nullptr) {
+            for (int a = 0; a < 3; a++) {
+                const interval& slab = grid.bounds.axis_interval(a);
+                const double d = r.direction()[a];
+                if (d == 0) {
+                    if (!slab.contains(r.origin()[a])) return false;
+                    continue;
+                }
+                double t0 = (slab.min - r.origin()[a]) / d;
+                double t1 = (slab.max - r.origin()[a]) / d;
+                if (t0 > t1) {
+                    double swap = t0;
+                    t0 = t1;
+                    t1 = swap;
+                }
+                inside = interval(fmax(inside.min, t0), fmin(inside.max, t1));
+            }
+        }
+        return inside.min < inside.max;
+    }
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "../bvh.hpp"
+#include "../mesh.hpp"
+#include "cu_hittable.hpp"
+
+/* Ray in the sheared space of the watertight ray/triangle test (Woop, Benthin
+ * and Wald, "Watertight Ray/Triangle Intersection", JCGT 2013). The ray is
+ * permuted so that its largest direction component is z and sheared so that
+ * it points along +z; the shear only depends on the ray, so it is computed
+ * once and shared by all triangles the ray is tested against.
+ */
+struct watertight_ray {
+    point3 origin;
+    int kx, ky, kz;
+    double sx, sy, sz;
+
+    __device__ watertight_ray(const ray& r) : origin(r.origin()) {
+        const vec3& d = r.direction();
+        kz = 0;
+        if (fabs(d[1]) > fabs(d[kz])) kz = 1;
+        if (fabs(d[2]) > fabs(d[kz])) kz = 2;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // Keep the winding of the triangles.
+        if (d[kz] < 0) {
+            int k = kx;
+            kx = ky;
+            ky = k;
+        }
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0 / d[kz];
+    }
+};
+
+/* Watertight ray/triangle test: rays through shared edges and vertices never
+ * slip between the adjacent triangles. On a hit, `t` is the ray parameter
+ * and b0, b1, b2 are the barycentric weights of the vertices.
+ */
+__device__ inline bool triangle_hit(const watertight_ray& wr,
+                                    const mesh_vertex& p0,
+                                    const mesh_vertex& p1,
+                                    const mesh_vertex& p2, interval ray_t,
+                                    double& t, double b[3]) {
+    const vec3 a(p0.x - wr.origin[0], p0.y - wr.origin[1], p0.z - wr.origin[2]);
+    const vec3 c1(p1.x - wr.origin[0], p1.y - wr.origin[1],
+                  p1.z - wr.origin[2]);
+    const vec3 c2(p2.x - wr.origin[0], p2.y - wr.origin[1],
+                  p2.z - wr.origin[2]);
+
+    const double ax = a[wr.kx] - wr.sx * a[wr.kz];
+    const double ay = a[wr.ky] - wr.sy * a[wr.kz];
+    const double bx = c1[wr.kx] - wr.sx * c1[wr.kz];
+    const double by = c1[wr.ky] - wr.sy * c1[wr.kz];
+    const double cx = c2[wr.kx] - wr.sx * c2[wr.kz];
+    const double cy = c2[wr.ky] - wr.sy * c2[wr.kz];
+
+    // Scaled barycentric coordinates: twice the signed areas of the
+    // sub-triangles seen along the ray. Both windings are accepted.
+    const double u = cx * by - cy * bx;
+    const double v = ax * cy - ay * cx;
+    const double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+    const double det = u + v + w;
+    if (det == 0) return false;
+
+    const double tz = u * (wr.sz * a[wr.kz]) + v * (wr.sz * c1[wr.kz]) +
+                      w * (wr.sz * c2[wr.kz]);
+    const double inv_det = 1.0 / det;
+    t = tz * inv_det;
+    if (!ray_t.surrounds(t)) return false;
+
+    b[0] = u * inv_det;
+    b[1] = v * inv_det;
+    b[2] = w * inv_det;
+    return true;
+}
+
+/* Indexed triangle mesh with its own bounding volume hierarchy. The triangles
+ * are stored in the primitive order of the hierarchy, so every leaf covers a
+ * contiguous range and is tested against one shared watertight_ray.
+ */
+class cu_mesh : public cu_hittable {
+   public:
+    __device__ cu_mesh(const bvh_node* nodes, const mesh_vertex* vertices,
+                       const mesh_vertex* normals,
+                       const mesh_triangle* triangles, cu_material* mat)
+        : nodes(nodes),
+          vertices(vertices),
+          normals(normals),
+          triangles(triangles),
+          mat(mat) {}
+
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        const watertight_ray wr(r);
+        double closest_so_far = ray_t.max;
+        int closest = -1;
+        double b1 = 0, b2 = 0;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node& node = nodes[stack[--top]];
+            if (!node.box.hit(r, interval(ray_t.min, closest_so_far)))
+                continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    const mesh_triangle& tri = triangles[i];
+                    double t, b[3];
+                    if (triangle_hit(wr, vertices[tri.v[0]],
+                                     vertices[tri.v[1]], vertices[tri.v[2]],
+                                     interval(ray_t.min, closest_so_far), t,
+                                     b)) {
+                        closest_so_far = t;
+                        closest = i;
+                        b1 = b[1];
+                        b2 = b[2];
+                    }
+                }
+            } else {
+                bool dir_neg = r.direction()[node.axis] < 0;
+                stack[top++] = node.first + (dir_neg ? 0 : 1);
+                stack[top++] = node.first + (dir_neg ? 1 : 0);
+            }
+        }
+
+        if (closest < 0) return false;
+
+        hit.t = closest_so_far;
+        hit.prim = this;
+        hit.index = closest;
+        hit.coords[0] = b1;
+        hit.coords[1] = b2;
+        hit.instance_count = 0;
+        return true;
+    }
+
+    __device__ void finalize(const ray& r, const cu_hit& hit,
+                             cu_hit_record& rec) const override {
+        const mesh_triangle& tri = triangles[hit.index];
+        rec.p = r.at(hit.t);
+        rec.mat = mat;
+        rec.uv_per_unit = 0;  // No texture coordinates yet
+        rec.u = rec.v = 0;
+
+        if (tri.n[0] >= 0) {
+            double bary[3] = {1 - hit.coords[0] - hit.coords[1],
+                              hit.coords[0], hit.coords[1]};
+            vec3 n(0, 0, 0);
+            for (int k = 0; k < 3; k++) {
+                const mesh_vertex& nk = normals[tri.n[k]];
+                n += bary[k] * vec3(nk.x, nk.y, nk.z);
+            }
+            rec.set_face_normal(r, unit_vector(n));
+        } else {
+            const mesh_vertex& p0 = vertices[tri.v[0]];
+            const mesh_vertex& p1 = vertices[tri.v[1]];
+            const mesh_vertex& p2 = vertices[tri.v[2]];
+            vec3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+            vec3 e2(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+            rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+        }
+    }
+
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        const watertight_ray wr(r);
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const bvh_node& node = nodes[stack[--top]];
+            if (!node.box.hit(r, ray_t)) continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    const mesh_triangle& tri = triangles[i];
+                    double t, b[3];
+                    if (triangle_hit(wr, vertices[tri.v[0]],
+                                     vertices[tri.v[1]], vertices[tri.v[2]],
+                                     ray_t, t, b))
+                        return true;
+                }
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+        return false;
+    }
+
+    virtual cu_hittable* clone() const override { return new cu_mesh(*this); }
+
+   private:
+    const bvh_node* nodes;
+    const mesh_vertex* vertices;
+    const mesh_vertex* normals;
+    const mesh_triangle* triangles;  // In hierarchy order
+    cu_material* mat;
+};
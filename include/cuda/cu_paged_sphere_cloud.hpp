@@ -0,0 +1,145 @@
+#pragma once
+
+#include "../paged_scene.hpp"
+#include "cu_render.hpp"
+#include "cu_sphere_cloud.hpp"
+
+/* Sphere cloud whose sphere data is paged in from a scene file (see
+ * paged_scene.hpp). A ray that reaches a brick outside the device cache
+ * requests it, raises the fault flag of its thread and gives up.
+ */
+class cu_paged_sphere_cloud : public cu_hittable {
+   public:
+    __device__ cu_paged_sphere_cloud(const cloud_node* nodes,
+                                     const sphere_frame* frames,
+                                     const packed_sphere* slots,
+                                     const int* brick_slot,
+                                     unsigned int* requests,
+                                     unsigned int* touched,
+                                     unsigned int* const* fault_cell,
+                                     cu_material** materials)
+        : nodes(nodes),
+          frames(frames),
+          slots(slots),
+          brick_slot(brick_slot),
+          requests(requests),
+          touched(touched),
+          fault_cell(fault_cell),
+          materials(materials) {}
+
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        double closest_so_far = ray_t.max;
+        int closest = -1;
+
+        int stack[sphere_cloud_stack_size];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const cloud_node& node = nodes[stack[--top]];
+            if (!cloud_node_hit(node, r, interval(ray_t.min, closest_so_far)))
+                continue;
+
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+
+            int leaf = node.first / sphere_cloud_leaf_size;
+            const packed_sphere* spheres = brick_spheres(leaf);
+            if (spheres == nullptr) return false;
+
+            const sphere_frame& frame = frames[leaf];
+            point3 center;
+            double radius, root;
+            for (int i = node.first; i < node.first + node.count; i++) {
+                if (packed_sphere_root(spheres[i], frame, r,
+                                       interval(ray_t.min, closest_so_far),
+                                       center, radius, root)) {
+                    closest_so_far = root;
+                    closest = i;
+                }
+            }
+        }
+
+        if (closest < 0) return false;
+        hit.t = closest_so_far;
+        hit.prim = this;
+        hit.index = closest;
+        hit.instance_count = 0;
+        return true;
+    }
+
+    // Bricks stay resident until the pass ends, so the hit's brick is still
+    // there.
+    __device__ void finalize(const ray& r, const cu_hit& hit,
+                             cu_hit_record& rec) const override {
+        int leaf = hit.index / sphere_cloud_leaf_size;
+        packed_sphere_finalize(brick_spheres(leaf)[hit.index], frames[leaf],
+                               materials, r, hit.t, rec);
+    }
+
+    // Faults like hit() on a missing brick, so the sample is redone.
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        int stack[sphere_cloud_stack_size];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const cloud_node& node = nodes[stack[--top]];
+            if (!cloud_node_hit(node, r, ray_t)) continue;
+
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+
+            int leaf = node.first / sphere_cloud_leaf_size;
+            const packed_sphere* spheres = brick_spheres(leaf);
+            if (spheres == nullptr) return false;
+
+            const sphere_frame& frame = frames[leaf];
+            point3 center;
+            double radius, root;
+            for (int i = node.first; i < node.first + node.count; i++)
+                if (packed_sphere_root(spheres[i], frame, r, ray_t, center,
+                                       radius, root))
+                    return true;
+        }
+        return false;
+    }
+
+    virtual cu_hittable* clone() const override {
+        return new cu_paged_sphere_cloud(*this);
+    }
+
+   private:
+    /* Spheres of the brick holding `leaf`, indexed like the unpaged sphere
+     * array, or null after requesting the brick and raising the fault flag.
+     */
+    __device__ const packed_sphere* brick_spheres(int leaf) const {
+        int brick = leaf / paged_brick_leaves;
+        int slot = brick_slot[brick];
+        if (slot < 0) {
+            requests[brick] = 1;
+            unsigned int* faults = *fault_cell;
+            if (faults != nullptr) faults[launch_thread_index()] = 1;
+            return nullptr;
+        }
+        touched[brick] = 1;
+        return slots + size_t(slot) * paged_brick_spheres -
+               size_t(brick) * paged_brick_spheres;
+    }
+
+    const cloud_node* nodes;
+    const sphere_frame* frames;
+    const packed_sphere* slots;
+    const int* brick_slot;
+    unsigned int* requests;
+    unsigned int* touched;
+    unsigned int* const* fault_cell;
+    cu_material** materials;
+};
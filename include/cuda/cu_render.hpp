@@ -0,0 +1,90 @@
+#pragma once
+
+#include <curand_kernel.h>
+#include <vector>
+
+#include "cu_camera.hpp"
+#include "cu_hittable.hpp"
+
+// Pixel rectangle [x0, x1) x [y0, y1) of a render target.
+struct tile {
+    int x0, y0;
+    int x1, y1;
+
+    HD int width() const { return x1 - x0; }
+    HD int height() const { return y1 - y0; }
+};
+
+/* Device view of a render_buffer. `accum` holds the running sum of radiance
+ * samples for every pixel and `samples` how many samples went into it, so a
+ * pass can be resumed or extended at any time without rescaling.
+ */
+struct render_target {
+    color3* accum;
+    unsigned int* samples;
+    double* lum_sq;
+    // Optional, one flag per launched thread (see launch_thread_index). Set
+    // by geometry that had to give up on a ray, e.g. because its data is not
+    // resident; the sample is then dropped and rendered again later.
+    unsigned int* faults;
+    // Optional outputs of feature_aov: sums of the first hit normals and
+    // albedos, and the masks of the materials every pixel's paths hit.
+    vec3* aov_normal;
+    color3* aov_albedo;
+    unsigned long long* material_masks;
+    // Rays traced, with feature_stats.
+    unsigned long long* ray_count;
+    int width;   // Of the whole image
+    int height;
+    unsigned long long seed;
+    // Pixels held by the buffers above, row by row. Usually the whole image;
+    // streaming renders keep a single tile at a time.
+    tile window;
+
+    // Index of image pixel (i, j) in the buffers.
+    HD size_t index(int i, int j) const {
+        return size_t(j - window.y0) * window.width() + (i - window.x0);
+    }
+};
+
+// Index of the calling thread within its (2D) kernel launch.
+__device__ inline unsigned int launch_thread_index() {
+    unsigned int block = blockIdx.y * gridDim.x + blockIdx.x;
+    return block * blockDim.x * blockDim.y + threadIdx.y * blockDim.x +
+           threadIdx.x;
+}
+
+// Splits a width x height image into tiles of at most `size` pixels square,
+// in scanline order. No tiles for a `size` below 1.
+std::vector<tile> make_tiles(int width, int height, int size);
+
+// Mixes the render seed, pixel index and sample index into an independent
+// curand seed (splitmix64 finaliser). Every sample owns its random stream, so
+// the image only depends on the per-pixel sample counts and not on how the
+// samples were split across passes or runs.
+HD inline unsigned long long sample_seed(unsigned long long seed,
+                                         unsigned long long pixel,
+                                         unsigned long long sample) {
+    unsigned long long z = seed ^ (pixel * 0x9E3779B97F4A7C15ull) ^
+                           (sample * 0xC2B2AE3D27D4EB4Full);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* Adds up to `num_samples` samples to every pixel of `target`, stopping at
+ * `target_samples` per pixel, with the kernel compiled for `features` (see
+ * cu_features.hpp). Blocks until the pass is finished.
+ */
+cudaError_t launch_render_pass(cu_hittable** d_world, cu_camera* d_cam,
+                               render_target target, int num_samples,
+                               unsigned int target_samples,
+                               unsigned int features);
+
+// Same as launch_render_pass, restricted to the pixels of `region` (inside
+// the target's window) and queued on `stream` without waiting for it. Only
+// fails when `features` has no kernel.
+cudaError_t launch_render_tile(cu_hittable** d_world, cu_camera* d_cam,
+                               render_target target, tile region,
+                               int num_samples, unsigned int target_samples,
+                               unsigned int features, cudaStream_t stream);
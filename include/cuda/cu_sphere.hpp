@@ -12,9 +12,38 @@ class cu_sphere : public cu_hittable {
             // printf("center: %f, %f, %f\n", center.x(), center.y(), center.z());
         }
 
-    __device__ bool hit(const ray& r, interval ray_t,
-                cu_hit_record& rec) const override {
-        // printf("->sphere hit\n");
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        double root;
+        if (!nearest_root(r, ray_t, root)) return false;
+
+        hit.t = root;
+        hit.prim = this;
+        hit.instance_count = 0;
+        return true;
+    }
+
+    __device__ void finalize(const ray& r, const cu_hit& hit,
+                             cu_hit_record& rec) const override {
+        rec.p = r.at(hit.t);
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        rec.set_sphere_uv(outward_normal, radius);
+        rec.mat = mat;
+    }
+
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return nearest_root(r, ray_t, root);
+    }
+
+    virtual cu_hittable* clone() const override {
+        return new cu_sphere(*this);
+    }
+
+   private:
+    __device__ bool nearest_root(const ray& r, interval ray_t,
+                                 double& root) const {
         vec3 oc = center - r.origin();
         auto a = r.direction().length_squared();
         auto h = dot(r.direction(), oc);
@@ -30,28 +59,14 @@ class cu_sphere : public cu_hittable {
 
         // Find the nearest root that lies in the acceptable range.
         // printf("root finding\n");
-        auto root = (h - sqrtd) / a;
+        root = (h - sqrtd) / a;
         if (!ray_t.surrounds(root)) {
             root = (h + sqrtd) / a;
             if (!ray_t.surrounds(root)) return false;
         }
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
-
-        // printf("Setting normal\n");
-        vec3 outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
-
         return true;
     }
 
-    virtual cu_hittable* clone() const override {
-        return new cu_sphere(*this);
-    }
-
-   private:
     point3 center;
     double radius;
     cu_material* mat;
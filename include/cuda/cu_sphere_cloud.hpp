@@ -0,0 +1,180 @@
+#pragma once
+
+#include "../sphere_cloud.hpp"
+#include "cu_hittable.hpp"
+
+// Slab test against the float bounds of a node, evaluated in double.
+__device__ inline bool cloud_node_hit(const cloud_node& node, const ray& r,
+                                      interval ray_t) {
+    for (int axis = 0; axis < 3; axis++) {
+        const double adinv = 1.0 / r.direction()[axis];
+        auto t0 = (node.lo[axis] - r.origin()[axis]) * adinv;
+        auto t1 = (node.hi[axis] - r.origin()[axis]) * adinv;
+        if (t0 > t1) {
+            auto t = t0;
+            t0 = t1;
+            t1 = t;
+        }
+        if (t0 > ray_t.min) ray_t.min = t0;
+        if (t1 < ray_t.max) ray_t.max = t1;
+        if (ray_t.max <= ray_t.min) return false;
+    }
+    return true;
+}
+
+/* Intersects a quantised sphere. Candidates are rejected with a float test
+ * first and the remaining ones are intersected in double precision.
+ */
+__device__ inline bool packed_sphere_root(const packed_sphere& s,
+                                          const sphere_frame& frame,
+                                          const ray& r, interval ray_t,
+                                          point3& center, double& radius,
+                                          double& root) {
+    center = point3(frame.origin[0] + s.center[0] * frame.step,
+                  frame.origin[1] + s.center[1] * frame.step,
+                  frame.origin[2] + s.center[2] * frame.step);
+    radius = s.radius * frame.step;
+    vec3 oc = center - r.origin();
+
+    // Float rejection. The radius margin of 1e-3 |oc| is well above the
+    // rounding error of the float discriminant, so no hit is lost.
+    float ox = oc[0], oy = oc[1], oz = oc[2];
+    float dx = r.direction()[0], dy = r.direction()[1],
+          dz = r.direction()[2];
+    float oc_len_sq = ox * ox + oy * oy + oz * oz;
+    float margin = float(radius) + 1e-3f * sqrtf(oc_len_sq);
+    float af = dx * dx + dy * dy + dz * dz;
+    float hf = dx * ox + dy * oy + dz * oz;
+    if (hf * hf - af * (oc_len_sq - margin * margin) < 0) return false;
+
+    auto a = r.direction().length_squared();
+    auto h = dot(r.direction(), oc);
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = h * h - a * c;
+    if (discriminant < 0) return false;
+
+    auto sqrtd = sqrt(discriminant);
+
+    // Find the nearest root that lies in the acceptable range.
+    root = (h - sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+        root = (h + sqrtd) / a;
+        if (!ray_t.surrounds(root)) return false;
+    }
+    return true;
+}
+
+// Surface data of a hit on a quantised sphere.
+__device__ inline void packed_sphere_finalize(const packed_sphere& s,
+                                              const sphere_frame& frame,
+                                              cu_material* const* materials,
+                                              const ray& r, double t,
+                                              cu_hit_record& rec) {
+    point3 center(frame.origin[0] + s.center[0] * frame.step,
+                  frame.origin[1] + s.center[1] * frame.step,
+                  frame.origin[2] + s.center[2] * frame.step);
+    double radius = s.radius * frame.step;
+
+    rec.p = r.at(t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.set_sphere_uv(outward_normal, radius);
+    rec.mat = materials[s.material];
+}
+
+// Spheres in the compact layout of sphere_cloud.hpp, with their own hierarchy.
+class cu_sphere_cloud : public cu_hittable {
+   public:
+    __device__ cu_sphere_cloud(const cloud_node* nodes,
+                               const sphere_frame* frames,
+                               const packed_sphere* spheres,
+                               cu_material** materials)
+        : nodes(nodes), frames(frames), spheres(spheres), materials(materials) {}
+
+    __device__ bool intersect(const ray& r, interval ray_t,
+                              cu_hit& hit) const override {
+        double closest_so_far = ray_t.max;
+        int closest = -1;
+
+        int stack[sphere_cloud_stack_size];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const cloud_node& node = nodes[stack[--top]];
+            if (!cloud_node_hit(node, r, interval(ray_t.min, closest_so_far)))
+                continue;
+
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+
+            const sphere_frame& frame =
+                frames[node.first / sphere_cloud_leaf_size];
+            point3 center;
+            double radius, root;
+            for (int i = node.first; i < node.first + node.count; i++) {
+                if (packed_sphere_root(spheres[i], frame, r,
+                                       interval(ray_t.min, closest_so_far),
+                                       center, radius, root)) {
+                    closest_so_far = root;
+                    closest = i;
+                }
+            }
+        }
+
+        if (closest < 0) return false;
+        hit.t = closest_so_far;
+        hit.prim = this;
+        hit.index = closest;
+        hit.instance_count = 0;
+        return true;
+    }
+
+    __device__ void finalize(const ray& r, const cu_hit& hit,
+                             cu_hit_record& rec) const override {
+        packed_sphere_finalize(spheres[hit.index],
+                               frames[hit.index / sphere_cloud_leaf_size],
+                               materials, r, hit.t, rec);
+    }
+
+    __device__ bool occluded(const ray& r, interval ray_t) const override {
+        int stack[sphere_cloud_stack_size];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const cloud_node& node = nodes[stack[--top]];
+            if (!cloud_node_hit(node, r, ray_t)) continue;
+
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+
+            const sphere_frame& frame =
+                frames[node.first / sphere_cloud_leaf_size];
+            point3 center;
+            double radius, root;
+            for (int i = node.first; i < node.first + node.count; i++)
+                if (packed_sphere_root(spheres[i], frame, r, ray_t, center,
+                                       radius, root))
+                    return true;
+        }
+        return false;
+    }
+
+    virtual cu_hittable* clone() const override {
+        return new cu_sphere_cloud(*this);
+    }
+
+   private:
+    const cloud_node* nodes;
+    const sphere_frame* frames;
+    const packed_sphere* spheres;
+    cu_material** materials;  // Device material pointers by index
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <curand_kernel.h>
+#include <curand_uniform.h>
+
+#include "../common.hpp"
+#include "../texture_cache.hpp"
+#include "cu_hittable.hpp"
+
+class cu_texture {
+   public:
+    HD virtual ~cu_texture() = default;
+
+    // Color at the hit point; `rand_state` drives stochastic filtering.
+    __device__ virtual color3 value(const cu_hit_record& rec,
+                                    curandState* rand_state) const = 0;
+
+    virtual cu_texture* clone() const = 0;
+};
+
+/* Mip-mapped image texture paged through a texture_cache. The level is chosen
+ * from the ray footprint at the hit and the uv rate of the surface; between
+ * two levels one is picked at random, weighted by the fraction, which averages
+ * to trilinear filtering over the samples of a pixel at the cost of a single
+ * bilinear lookup.
+ */
+class cu_image_texture : public cu_texture {
+   public:
+    __device__ cu_image_texture(const texture_pages* pages) : pages(pages) {}
+
+    __device__ color3 value(const cu_hit_record& rec,
+                            curandState* rand_state) const override {
+        const texture_level& base = pages->levels[0];
+        double lod = 0;
+        if (rec.uv_per_unit > 0 && rec.footprint > 0)
+            lod = log2(rec.footprint * rec.uv_per_unit *
+                       cu_max(base.width, base.height));
+        lod = fmin(fmax(lod, 0.0), double(pages->num_levels - 1));
+
+        int level = int(lod);
+        if (curand_uniform_double(rand_state) < lod - level) level++;
+
+        // Missing tiles were requested; the coarsest level is always
+        // resident, so this ends.
+        color3 c;
+        while (!bilinear(level, rec.u, rec.v, c)) level++;
+        return c;
+    }
+
+    virtual cu_texture* clone() const override {
+        return new cu_image_texture(*this);
+    }
+
+   private:
+    const texture_pages* pages;
+
+    __device__ bool bilinear(int level, double u, double v, color3& c) const {
+        const texture_level& lv = pages->levels[level];
+        // Texel centers at half integers, image row 0 at v = 1; repeats.
+        double x = (u - floor(u)) * lv.width - 0.5;
+        double y = (1 - (v - floor(v))) * lv.height - 0.5;
+        int x0 = int(floor(x)), y0 = int(floor(y));
+        double fx = x - x0, fy = y - y0;
+
+        color3 c00, c10, c01, c11;
+        if (!fetch(lv, x0, y0, c00) || !fetch(lv, x0 + 1, y0, c10) ||
+            !fetch(lv, x0, y0 + 1, c01) || !fetch(lv, x0 + 1, y0 + 1, c11))
+            return false;
+        c = (1 - fy) * ((1 - fx) * c00 + fx * c10) +
+            fy * ((1 - fx) * c01 + fx * c11);
+        return true;
+    }
+
+    __device__ bool fetch(const texture_level& lv, int x, int y,
+                          color3& c) const {
+        x = ((x % lv.width) + lv.width) % lv.width;
+        y = ((y % lv.height) + lv.height) % lv.height;
+        const int size = texture_tile_size;
+        int tile = lv.first_tile + (y / size) * lv.tiles_x + x / size;
+
+        int slot = pages->tile_slot[tile];
+        if (slot < 0) {
+            pages->requests[tile] = 1;
+            return false;
+        }
+        // Read first: most lookups find the bit set and skip the write.
+        if (!pages->touched[tile]) pages->touched[tile] = 1;
+
+        const texel& t = pages->slots[size_t(slot) * texture_tile_texels +
+                                      (y % size) * size + x % size];
+        c = color3(t.r * t.r, t.g * t.g, t.b * t.b) / (255.0 * 255.0);
+        return true;
+    }
+};
+
+/* Marble from Perlin gradient noise. Gradients come from hashing the lattice
+ * points instead of permutation tables, so the texture needs no memory beyond
+ * its parameters.
+ */
+class cu_noise_texture : public cu_texture {
+   public:
+    HD cu_noise_texture(double scale, const color3& color)
+        : scale(scale), color(color) {}
+
+    __device__ color3 value(const cu_hit_record& rec,
+                            curandState*) const override {
+        return color * 0.5 *
+               (1 + sin(scale * rec.p.z() + 10 * turbulence(rec.p, 7)));
+    }
+
+    virtual cu_texture* clone() const override {
+        return new cu_noise_texture(*this);
+    }
+
+   private:
+    double scale;
+    color3 color;
+
+    HD static double gradient(int x, int y, int z, double dx, double dy,
+                              double dz) {
+        unsigned int h = unsigned(x) * 73856093u ^ unsigned(y) * 19349663u ^
+                         unsigned(z) * 83492791u;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        // One of the 12 cube edge directions (improved Perlin noise).
+        h &= 15;
+        double a = h < 8 ? dx : dy;
+        double b = h < 4 ? dy : (h == 12 || h == 14 ? dx : dz);
+        return ((h & 1) ? -a : a) + ((h & 2) ? -b : b);
+    }
+
+    HD static double fade(double t) {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    HD static double lerp(double a, double b, double t) {
+        return a + t * (b - a);
+    }
+
+    HD static double noise(const point3& p) {
+        double fx = floor(p.x()), fy = floor(p.y()), fz = floor(p.z());
+        int x = int(fx), y = int(fy), z = int(fz);
+        double dx = p.x() - fx, dy = p.y() - fy, dz = p.z() - fz;
+        double u = fade(dx), v = fade(dy), w = fade(dz);
+
+        double n[2][2];
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                n[i][j] = lerp(
+                    gradient(x + i, y + j, z, dx - i, dy - j, dz),
+                    gradient(x + i, y + j, z + 1, dx - i, dy - j, dz - 1), w);
+        return lerp(lerp(n[0][0], n[0][1], v), lerp(n[1][0], n[1][1], v), u);
+    }
+
+    HD static double turbulence(point3 p, int depth) {
+        double sum = 0;
+        double weight = 1;
+        for (int i = 0; i < depth; i++) {
+            sum += weight * fabs(noise(p));
+            weight *= 0.5;
+            p *= 2;
+        }
+        return sum;
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Linear RGB floats, row major from the top row down.
+struct hdr_image {
+    int width = 0;
+    int height = 0;
+    std::vector<float> rgb;
+};
+
+// Reads a Portable Float Map (PF, color only) or a Radiance RGBE (.hdr)
+// image, picked by the file's magic.
+bool load_hdr_image(const std::string& path, hdr_image& image);
+
+/* Equirectangular environment with the distribution for importance sampling
+ * it: texels are picked in proportion to their luminance times the solid
+ * angle they cover (sin theta), first a row from the marginal distribution,
+ * then a column within the row. The cdfs have one more entry than texels,
+ * starting at 0 and ending at 1; texel probabilities are their differences.
+ * Black rows, or a black image, are sampled uniformly.
+ */
+struct environment_map {
+    hdr_image image;
+    std::vector<float> row_cdf;     // height + 1
+    std::vector<float> column_cdf;  // height * (width + 1)
+};
+
+environment_map build_environment(hdr_image image);
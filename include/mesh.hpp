@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "aabb.hpp"
+
+struct mesh_vertex {
+    float x, y, z;
+};
+
+// Indices into the shared vertex and normal buffers. Normals are -1 when the
+// triangle has no vertex normals.
+struct mesh_triangle {
+    int v[3];
+    int n[3];
+};
+
+// Indexed triangle mesh with shared vertex and normal buffers.
+struct triangle_mesh {
+    std::vector<mesh_vertex> vertices;
+    std::vector<mesh_vertex> normals;
+    std::vector<mesh_triangle> triangles;
+
+    aabb triangle_box(size_t i) const {
+        aabb box;
+        for (int k = 0; k < 3; k++) {
+            const mesh_vertex& p = vertices[triangles[i].v[k]];
+            point3 q(p.x, p.y, p.z);
+            box = aabb(box, aabb(q, q));
+        }
+
+        // Axis aligned triangles have flat boxes, which the slab test misses.
+        const double delta = 1e-4;
+        interval axes[3];
+        for (int a = 0; a < 3; a++) {
+            axes[a] = box.axis_interval(a);
+            if (axes[a].size() < delta)
+                axes[a] = interval(axes[a].min - delta / 2,
+                                   axes[a].max + delta / 2);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+    aabb bounds() const {
+        aabb box;
+        for (size_t i = 0; i < triangles.size(); i++)
+            box = aabb(box, triangle_box(i));
+        return box;
+    }
+};
+
+/* Loads the vertices, vertex normals and faces of a Wavefront OBJ file.
+ * Polygons are triangulated as fans; texture coordinates, groups and
+ * materials are ignored. The file is parsed in parallel chunks.
+ */
+bool load_obj(const std::string& path, triangle_mesh& mesh);
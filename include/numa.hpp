@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* NUMA topology of the host, read from sysfs. Machines without NUMA
+ * information (or with a single node) are reported as one node holding all
+ * CPUs, in which case nothing is pinned.
+ *
+ * Nodes with CPUs are numbered 0 to nodes() - 1 in the order of their kernel
+ * ids, which may have gaps (offline or memory-only nodes). Every function
+ * here takes and returns these positions, not kernel ids.
+ */
+struct numa_topology {
+    std::vector<std::vector<int>> node_cpus;  // CPUs of every node
+    std::vector<int> node_ids;                // Kernel id of every node
+
+    size_t nodes() const { return node_cpus.size(); }
+
+    // Position of the node with kernel id `id`, or -1.
+    int index_of(int id) const;
+
+    // Detected once per process.
+    static const numa_topology& system();
+};
+
+// Restricts the calling thread to the CPUs of `node`.
+bool pin_thread_to_node(int node);
+
+// Node the PCIe device of CUDA device `device` is attached to, or -1.
+int device_numa_node(int device);
+
+/* Node of every page of [data, data + bytes), -1 for pages that were not
+ * touched yet or sit on a node without CPUs. Used to check where first-touch placement put a buffer.
+ */
+std::vector<int> page_nodes(const void* data, size_t bytes);
+
+/* Allocator that leaves default-constructed elements uninitialised. The
+ * pages of a large buffer are then placed on the node of the thread that
+ * first writes them instead of the one that allocated it. Only for
+ * trivially copyable types; value-initialising constructors still run.
+ */
+template <class T>
+struct first_touch_allocator : std::allocator<T> {
+    template <class U>
+    struct rebind {
+        using other = first_touch_allocator<U>;
+    };
+
+    first_touch_allocator() = default;
+    template <class U>
+    first_touch_allocator(const first_touch_allocator<U>&) {}
+
+    template <class U>
+    void construct(U*) {}
+
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+
+// Command line settings of the renderer.
+struct render_options {
+    int samples_per_pixel = 500;  // Total samples per pixel to reach
+    int pass_samples = 4;         // Samples added to every pixel per pass
+    unsigned long long seed = 42;
+    int width = 1200;  // Image width in pixels, the height follows at 16:9
+
+    std::string checkpoint_path;       // Empty: no checkpoints
+    double checkpoint_interval = 300;  // Seconds between checkpoints
+    std::string resume_path;           // Checkpoint to continue from
+
+    // Deadline mode: stop at the last pass that fits into `time_budget`
+    // seconds or once the estimated error drops to `target_error`. Without an
+    // explicit --spp the sample count is then unbounded.
+    double time_budget = 0;
+    double target_error = 0;
+
+    // Out-of-core scene file to render instead of the built-in scene, and
+    // the size of its device brick cache.
+    std::string scene_path;
+    size_t cache_mb = 1024;
+
+    // Wavefront OBJ mesh placed into the built-in scene.
+    std::string obj_path;
+
+    // Participating media in the built-in scene: fog of constant density
+    // `fog_density` (per unit length; 0: none) around everything, and a
+    // heterogeneous medium from a gridvolume file, its densities scaled by
+    // `volume_density`, at the grid's own bounds.
+    double fog_density = 0;
+    std::string volume_path;
+    double volume_density = 1;
+
+    // Textures of the built-in scene: a PPM image on the brown sphere and
+    // marble noise with `noise_scale` stripes per unit on the ground (0:
+    // plain ground). Image textures share a device tile cache of
+    // `texture_cache_mb`.
+    std::string texture_path;
+    double noise_scale = 0;
+    size_t texture_cache_mb = 256;
+
+    // Equirectangular HDR image (PFM or Radiance) lighting the scene instead
+    // of the sky gradient.
+    std::string environment_path;
+
+    // Interactive material editing: edits are read from stdin after the
+    // render and the image in `lookdev_path` is updated after each.
+    std::string lookdev_path;
+
+    // First hit normal and albedo images, written to <aov_prefix>.normal.ppm
+    // and <aov_prefix>.albedo.ppm.
+    std::string aov_prefix;
+
+    bool stats = false;  // Count rays and report the ray rate
+
+    // Cell size in pixels of the (biased) irradiance cache; 0: off.
+    double irradiance_cache_pixels = 0;
+
+    // Ambient occlusion (clay) preview with this radius instead of path
+    // tracing; 0: off. Without an explicit --spp it takes fewer samples.
+    double ao_distance = 0;
+
+    // Render tile by tile and write the image band by band as it finishes,
+    // without a full-frame buffer (see stream_render.hpp).
+    bool stream = false;
+
+    // Batch of cameras (see batch_render.hpp) rendered from one scene build,
+    // each written to its own file.
+    std::string views_path;
+
+    // Fix-up renders: only the pixels in the rectangle `region` (x0, y0, x1,
+    // y1, exclusive ends; empty when x1 <= x0) and the non-black pixels of
+    // the PPM `region_mask_path` are rendered, and patched into the
+    // checkpoint or PPM image `patch_path` in place.
+    int region[4] = {0, 0, 0, 0};
+    std::string region_mask_path;
+    std::string patch_path;
+
+    // Camera move (views file format) rendered frame by frame in order, each
+    // frame starting from the reprojected previous one (see temporal.hpp)
+    // and adding at least `fresh_samples` samples to every pixel.
+    std::string sequence_path;
+    int fresh_samples = 4;
+
+    // Timeline of the run in Chrome trace format (needs ENABLE_TRACING).
+    std::string trace_path;
+
+    // Writes a random test scene of `scene_spheres` spheres and exits.
+    std::string write_scene_path;
+    size_t scene_spheres = 1000000;
+};
+
+void print_usage(const char* program);
+
+// Returns false (after printing a message) on invalid arguments.
+bool parse_options(int argc, char** argv, render_options& opts);
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sphere_cloud.hpp"
+
+/* Out-of-core scenes. A scene file holds a sphere cloud (sphere_cloud.hpp)
+ * split into the hierarchy, which stays resident (about 2.5 bytes per
+ * sphere), and bricks of sphere data. A brick holds the spheres of
+ * `paged_brick_leaves` consecutive leaves and occupies one page of the file.
+ *
+ * The file is memory mapped and bricks are uploaded into a fixed size device
+ * cache on demand: a ray that reaches a missing brick requests it and faults,
+ * the render pass drops that sample, and the pass is relaunched after the
+ * requested bricks were paged in (see Allocator::render). Samples use fixed
+ * random streams, so the retried samples are the same as without paging.
+ */
+constexpr int paged_brick_leaves = 12;
+constexpr int paged_brick_spheres = paged_brick_leaves * sphere_cloud_leaf_size;
+constexpr int paged_page_size = 4096;
+
+// Smallest device cache that still makes progress: a relaunch pages in at
+// most half the cache, and a ray needs every brick it crosses resident.
+constexpr int paged_min_cache_bricks = 64;
+
+static_assert(paged_brick_spheres * sizeof(packed_sphere) <= paged_page_size,
+              "a brick must fit into a page");
+
+enum material_type : unsigned int {
+    material_lambertian = 0,
+    material_metal = 1,
+    material_dielectric = 2,
+};
+
+// Material description stored in scene files.
+struct material_record {
+    unsigned int type;
+    float albedo[3];
+    float param;  // Fuzz of metals, refraction index of dielectrics
+};
+
+struct scene_file_header {
+    char magic[4] = {'R', 'T', 'S', 'C'};
+    unsigned int version = 1;
+    unsigned int page_size = paged_page_size;
+    unsigned int num_materials = 0;
+    unsigned long long num_nodes = 0;
+    unsigned long long num_frames = 0;
+    unsigned long long num_spheres = 0;
+    unsigned long long num_bricks = 0;
+    unsigned long long materials_offset = 0;
+    unsigned long long nodes_offset = 0;
+    unsigned long long frames_offset = 0;
+    unsigned long long bricks_offset = 0;  // Page aligned
+};
+
+// Builds a sphere cloud from `spheres` (sorting them) and writes it to `path`.
+bool write_scene_file(const std::string& path,
+                      std::vector<sphere_input>& spheres,
+                      const std::vector<material_record>& materials);
+
+struct paging_stats {
+    unsigned long long bricks = 0;           // Bricks in the scene
+    unsigned long long cache_bricks = 0;     // Device cache capacity
+    unsigned long long resident_bricks = 0;  // Currently in the cache
+    unsigned long long touched_bricks = 0;   // Recently used (clock bits)
+    unsigned long long loads = 0;            // Bricks uploaded so far
+    unsigned long long evictions = 0;
+    unsigned long long relaunches = 0;       // Passes rerun after faults
+    unsigned long long host_resident_bytes = 0;  // Mapped pages in memory
+};
+
+class paged_scene {
+   public:
+    paged_scene() {}
+    ~paged_scene();
+
+    paged_scene(const paged_scene&) = delete;
+    paged_scene& operator=(const paged_scene&) = delete;
+
+    // Maps the scene at `path` and sets up a device cache of `cache_bytes`.
+    bool open(const std::string& path, size_t cache_bytes);
+
+    /* Uploads the bricks requested by the last launch, evicting the least
+     * recently used ones when the cache is full. Returns the number of bricks
+     * uploaded, 0 when the launch needed nothing new.
+     */
+    size_t service();
+
+    /* Hints the kernel to read the bricks that were used during the last
+     * pass but are no longer cached, so that disk reads overlap with the
+     * next pass instead of stalling the relaunches.
+     */
+    void prefetch();
+
+    // Fault flags for a launch of `threads` threads (grown as needed).
+    unsigned int* faults(size_t threads);
+
+    paging_stats stats();
+
+    const material_record* materials() const { return material_table; }
+    unsigned int num_materials() const { return header.num_materials; }
+    aabb bounds() const;
+
+    // Device side state, read by cu_paged_sphere_cloud.
+    cloud_node* d_nodes = nullptr;
+    sphere_frame* d_frames = nullptr;
+    packed_sphere* d_slots = nullptr;    // Cache, `cache_bricks` bricks
+    int* brick_slot = nullptr;           // Cache slot per brick or -1
+    unsigned int* requests = nullptr;    // Set by rays missing a brick
+    unsigned int* touched = nullptr;     // Set by rays using a brick
+    unsigned int* fault_flags = nullptr;
+    unsigned int** fault_cell = nullptr;  // Current fault_flags, for kernels
+
+   private:
+    const char* brick_data(size_t brick) const;
+    void advise(size_t brick, int advice) const;
+    int take_slot();
+
+    scene_file_header header;
+    int fd = -1;
+    char* map = nullptr;
+    size_t map_size = 0;
+    const material_record* material_table = nullptr;
+
+    size_t cache_bricks = 0;
+    std::vector<long long> slot_brick;  // Brick per cache slot or -1
+    std::vector<int> free_slots;
+    size_t clock_hand = 0;
+    size_t fault_capacity = 0;
+    std::vector<unsigned char> pinned;  // Slots filled by the current batch
+    std::vector<long long> evicted;     // Since the last prefetch()
+    bool bad_materials_reported = false;
+
+    paging_stats counters;
+};
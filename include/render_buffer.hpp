@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "color.hpp"
+#include "numa.hpp"
+
+HD inline double luminance(const color3& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+/* Estimated relative RMS error of the image: the standard error of every
+ * pixel mean (from the running sums of luminance and squared luminance),
+ * relative to the pixel luminance and averaged over the image. Pixels need
+ * two samples before they contribute.
+ */
+inline double estimate_error(const color3* accum, const double* lum_sq,
+                             const unsigned int* samples, size_t n) {
+    double total = 0;
+    size_t counted = 0;
+    for (size_t i = 0; i < n; i++) {
+        double k = samples[i];
+        if (k < 2) continue;
+        double mean = luminance(accum[i]) / k;
+        double variance = (lum_sq[i] / k - mean * mean) * k / (k - 1);
+        total += std::fmax(variance, 0.0) / k / (mean * mean + 1e-2);
+        counted++;
+    }
+    return counted ? std::sqrt(total / counted) : inf;
+}
+
+/* Host side accumulation state of a render. Pixels store the sum of all
+ * their samples together with the sample count, which is everything needed
+ * to resume a render or to add samples to a finished one. The sum of squared
+ * sample luminance is kept for error estimation.
+ */
+class render_buffer {
+   public:
+    template <class T>
+    using storage = std::vector<T, first_touch_allocator<T>>;
+
+    int width = 0;
+    int height = 0;
+    unsigned long long seed = 0;
+    storage<color3> accum;
+    storage<unsigned int> samples;
+    storage<double> lum_sq;
+    // Optional: materials hit by the paths of every pixel (cu_material::mask),
+    // for relighting after material edits. Not saved in checkpoints.
+    storage<unsigned long long> material_masks;
+    // Optional: sums of the first hit normals and albedos of the samples.
+    storage<vec3> aov_normal;
+    storage<color3> aov_albedo;
+
+    render_buffer() {}
+    render_buffer(int width, int height, unsigned long long seed)
+        : width(width),
+          height(height),
+          seed(seed),
+          accum(size_t(width) * height, color3(0, 0, 0)),
+          samples(size_t(width) * height, 0),
+          lum_sq(size_t(width) * height, 0.0) {}
+
+    // Leaves the pixels uninitialised (and their pages unplaced) for the
+    // caller to fill, see first_touch_allocator.
+    struct uninitialized_t {};
+    static constexpr uninitialized_t uninitialized{};
+
+    render_buffer(int width, int height, unsigned long long seed,
+                  uninitialized_t)
+        : width(width),
+          height(height),
+          seed(seed),
+          accum(size_t(width) * height),
+          samples(size_t(width) * height),
+          lum_sq(size_t(width) * height) {}
+
+    size_t size() const { return size_t(width) * height; }
+
+    // Starts recording material masks in the following renders.
+    void track_materials() { material_masks.assign(size(), 0); }
+
+    // Starts recording the normal and albedo AOVs in the following renders.
+    void track_aovs() {
+        aov_normal.assign(size(), vec3(0, 0, 0));
+        aov_albedo.assign(size(), color3(0, 0, 0));
+    }
+
+    unsigned int min_samples() const {
+        if (samples.empty()) return 0;
+        return *std::min_element(samples.begin(), samples.end());
+    }
+
+    // Average radiance of pixel `i`.
+    color3 resolve(size_t i) const {
+        if (samples[i] == 0) return color3(0, 0, 0);
+        return accum[i] / samples[i];
+    }
+
+    double estimated_error() const {
+        return estimate_error(accum.data(), lum_sq.data(), samples.data(),
+                              size());
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "cuda/cu_allocate.hpp"
+#include "cuda/cu_render.hpp"
+#include "options.hpp"
+#include "render_buffer.hpp"
+
+struct job_result {
+    render_buffer buffer;
+    bool ok = true;
+    bool cancelled = false;
+
+    // On NUMA machines: pages of `buffer` that ended up on the node whose
+    // workers rendered them, out of all its pages. Without first-touch
+    // placement only the pages of the first node's share would be local.
+    size_t local_pages = 0;
+    size_t total_pages = 0;
+};
+
+struct job_settings {
+    int priority = 0;    // Higher priorities are scheduled first
+    int tile_size = 64;  // Pixels per tile side
+
+    // Called from worker threads with the finished fraction of the job.
+    std::function<void(double progress)> on_progress;
+
+    // Called once the result is available, from the thread that completed
+    // it (a worker, or the submitting thread if the job failed to start).
+    std::function<void()> on_finished;
+};
+
+/* Handle of a render job running on the global thread pool. A job is split
+ * into tiles; every tile renders one pass at a time and then requeues itself,
+ * so tiles of many jobs interleave on the pool according to their priority.
+ * On NUMA machines the image is split into one band of rows per node; tiles
+ * run on the workers of their band's node, which also first-touch the host
+ * pages of the band in the result.
+ */
+class render_job {
+   public:
+    double progress() const {
+        return double(finished_passes) / double(total_passes);
+    }
+
+    // Stops scheduling new tile passes. The result is still delivered, with
+    // `cancelled` set and the samples rendered so far.
+    void cancel() { cancel_requested = true; }
+
+    bool done() const {
+        return result.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+    }
+
+    const job_result& wait() const { return result.get(); }
+
+    std::shared_future<job_result> result;
+
+   private:
+    friend std::shared_ptr<render_job> submit_render_job(
+        std::shared_ptr<const Allocator> scene, const cu_camera& cam,
+        const render_options& opts, job_settings settings);
+
+    render_job() {}
+
+    static void run_tile(std::shared_ptr<render_job> job, size_t index,
+                         unsigned int done);
+    void tile_finished(size_t index);
+    void deliver(job_result res);
+    int tile_node(size_t index) const;
+    void count_local_pages(job_result& res) const;
+
+    std::shared_ptr<const Allocator> scene;
+    render_options opts;
+    job_settings settings;
+    cu_camera* d_cam = nullptr;
+    render_target target{};
+    unsigned int features = 0;
+    std::vector<tile> tiles;
+    render_buffer output;  // Filled tile by tile on the rendering nodes
+
+    std::atomic<size_t> remaining_tiles{0};
+    std::atomic<long long> finished_passes{0};
+    long long total_passes = 1;
+    std::atomic<bool> cancel_requested{false};
+    std::atomic<bool> failed{false};
+    std::promise<job_result> promise;
+};
+
+/* Queues a render of `scene` (already built, only read by the job) as seen by
+ * `cam`. The scene is shared, so any number of jobs can render it at the same
+ * time. Only the sample settings of `opts` are used.
+ * NOTE: jobs touch their managed buffers from the host while kernels of other
+ * jobs run, which needs a device with concurrent managed access (Pascal or
+ * newer on Linux).
+ */
+std::shared_ptr<render_job> submit_render_job(
+    std::shared_ptr<const Allocator> scene, const cu_camera& cam,
+    const render_options& opts, job_settings settings = job_settings());
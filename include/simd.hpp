@@ -0,0 +1,133 @@
+#pragma once
+
+/* Host SIMD backends of vec3, built with -DENABLE_SIMD_VEC3=ON (RT_SIMD_VEC3).
+ * A vec3 then holds four doubles, x, y, z and a zero pad, which are handled
+ * as one AVX register or two SSE2 / NEON registers. vec3.hpp falls back to
+ * scalar code on the device and on other hosts.
+ *
+ * AVX needs a host compiler targeting it (-DENABLE_NATIVE_ARCH=ON); SSE2 is
+ * part of every x86-64 target and NEON of every AArch64 one. Off by default:
+ * compilers already vectorise the packed scalar code well, and the pad costs
+ * a third more memory traffic. Per-ray hit arithmetic came out on par on
+ * x86-64, loops over vec3 arrays slower.
+ */
+
+#if defined(RT_SIMD_VEC3) && !defined(__CUDA_ARCH__)
+
+#if defined(__AVX__)
+
+#include <immintrin.h>
+#define VEC3_SIMD 1
+
+namespace simd {
+
+struct lanes {
+    __m256d v;
+};
+
+// vec3 is 16-byte aligned only, so that it needs no over-aligned heap.
+inline lanes load(const double* e) { return {_mm256_loadu_pd(e)}; }
+inline void store(double* e, lanes a) { _mm256_storeu_pd(e, a.v); }
+inline lanes splat(double t) { return {_mm256_set1_pd(t)}; }
+
+inline lanes add(lanes a, lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+inline lanes sub(lanes a, lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+inline lanes mul(lanes a, lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+inline lanes neg(lanes a) {
+    return {_mm256_xor_pd(a.v, _mm256_set1_pd(-0.0))};
+}
+
+// x + y + z of the lane products, summed in the order of the scalar code.
+inline double dot(lanes a, lanes b) {
+    __m256d p = _mm256_mul_pd(a.v, b.v);
+    __m128d xy = _mm256_castpd256_pd128(p);
+    __m128d zw = _mm256_extractf128_pd(p, 1);
+    __m128d sum = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, zw));
+}
+
+}  // namespace simd
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+#define VEC3_SIMD 1
+
+namespace simd {
+
+struct lanes {
+    __m128d xy, zw;
+};
+
+inline lanes load(const double* e) {
+    return {_mm_load_pd(e), _mm_load_pd(e + 2)};
+}
+inline void store(double* e, lanes a) {
+    _mm_store_pd(e, a.xy);
+    _mm_store_pd(e + 2, a.zw);
+}
+inline lanes splat(double t) { return {_mm_set1_pd(t), _mm_set1_pd(t)}; }
+
+inline lanes add(lanes a, lanes b) {
+    return {_mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw)};
+}
+inline lanes sub(lanes a, lanes b) {
+    return {_mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw)};
+}
+inline lanes mul(lanes a, lanes b) {
+    return {_mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw)};
+}
+inline lanes neg(lanes a) {
+    __m128d sign = _mm_set1_pd(-0.0);
+    return {_mm_xor_pd(a.xy, sign), _mm_xor_pd(a.zw, sign)};
+}
+
+inline double dot(lanes a, lanes b) {
+    __m128d xy = _mm_mul_pd(a.xy, b.xy);
+    __m128d zw = _mm_mul_sd(a.zw, b.zw);
+    __m128d sum = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, zw));
+}
+
+}  // namespace simd
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#include <arm_neon.h>
+#define VEC3_SIMD 1
+
+namespace simd {
+
+struct lanes {
+    float64x2_t xy, zw;
+};
+
+inline lanes load(const double* e) { return {vld1q_f64(e), vld1q_f64(e + 2)}; }
+inline void store(double* e, lanes a) {
+    vst1q_f64(e, a.xy);
+    vst1q_f64(e + 2, a.zw);
+}
+inline lanes splat(double t) { return {vdupq_n_f64(t), vdupq_n_f64(t)}; }
+
+inline lanes add(lanes a, lanes b) {
+    return {vaddq_f64(a.xy, b.xy), vaddq_f64(a.zw, b.zw)};
+}
+inline lanes sub(lanes a, lanes b) {
+    return {vsubq_f64(a.xy, b.xy), vsubq_f64(a.zw, b.zw)};
+}
+inline lanes mul(lanes a, lanes b) {
+    return {vmulq_f64(a.xy, b.xy), vmulq_f64(a.zw, b.zw)};
+}
+inline lanes neg(lanes a) { return {vnegq_f64(a.xy), vnegq_f64(a.zw)}; }
+
+inline double dot(lanes a, lanes b) {
+    float64x2_t xy = vmulq_f64(a.xy, b.xy);
+    double z = vgetq_lane_f64(a.zw, 0) * vgetq_lane_f64(b.zw, 0);
+    return vgetq_lane_f64(xy, 0) + vgetq_lane_f64(xy, 1) + z;
+}
+
+}  // namespace simd
+
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "aabb.hpp"
+
+/* Compact storage for very large numbers of spheres. Spheres are grouped into
+ * clusters of (at most) `sphere_cloud_leaf_size` spheres, one per hierarchy
+ * leaf. Each cluster has a local frame (origin and quantisation step) and a
+ * sphere stores its center and radius as 16 bit multiples of that step plus a
+ * 16 bit material index, 10 bytes in total. Together with the float node
+ * boxes and the frames this comes to about 12.5 bytes per sphere.
+ *
+ * Radii are rounded up and the node boxes are computed from the dequantised
+ * spheres and padded, so the boxes are always conservative. The dequantised
+ * sphere is the one that is rendered.
+ */
+constexpr int sphere_cloud_leaf_size = 32;
+// Entries of the device traversal stacks; a hierarchy may be at most one
+// level shallower (see valid_hierarchy in paged_scene.cpp).
+constexpr int sphere_cloud_stack_size = 64;
+
+struct sphere_input {
+    float center[3];
+    float radius;
+    unsigned short material;  // Index into the material table of the cloud
+};
+
+struct packed_sphere {
+    unsigned short center[3];
+    unsigned short radius;
+    unsigned short material;
+};
+
+struct sphere_frame {
+    float origin[3];
+    float step;
+};
+
+/* Hierarchy node with float bounds. Children of internal nodes (count == 0)
+ * are at `first` and `first + 1`. Leaves start at a multiple of the leaf size,
+ * so the frame of a leaf is frames[first / sphere_cloud_leaf_size].
+ */
+struct cloud_node {
+    float lo[3];
+    float hi[3];
+    int first;
+    int count;
+};
+
+struct sphere_cloud_data {
+    std::vector<cloud_node> nodes;
+    std::vector<sphere_frame> frames;
+    std::vector<packed_sphere> spheres;
+    aabb bounds;
+};
+
+// Sorts `input` in place into cluster order while building the cloud.
+sphere_cloud_data build_sphere_cloud(std::vector<sphere_input>& input);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ostream>
+
+#include "cuda/cu_allocate.hpp"
+#include "options.hpp"
+
+/* Renders `scene` through `cam` to `opts.samples_per_pixel` samples without
+ * a full-frame buffer, for images too large to hold in memory. Tiles are
+ * rendered in scanline order, a few at a time on separate streams, and only
+ * their own sample buffers are resident. Finished tiles are tonemapped into
+ * their band of rows, and every completed band is written to `out` as part
+ * of a binary PPM (P6). Peak memory is a fixed number of tiles plus the
+ * 8-bit rows of the bands in flight (3 bytes per pixel of a band).
+ *
+ * The image is the same as that of Allocator::render with the same seed.
+ * Paged scenes are not supported.
+ */
+bool render_streaming(const Allocator& scene, const cu_camera& cam,
+                      const render_options& opts, std::ostream& out);
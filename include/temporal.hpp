@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "cuda/cu_camera.hpp"
+#include "render_buffer.hpp"
+
+/* The previous frame of a camera sequence: its accumulated samples, its
+ * camera and the distance from the camera center to the first hit of the ray
+ * through the center of every pixel (see Allocator::render_depth: inf where
+ * that ray escaped, NaN on view dependent materials). Only one frame is
+ * kept, so the history is as large as a single frame whatever the length of
+ * the sequence.
+ */
+struct frame_history {
+    cu_camera camera;
+    render_buffer buffer;
+    std::vector<float> depth;
+
+    bool empty() const { return depth.empty(); }
+};
+
+struct reprojection_stats {
+    size_t reused = 0;
+    size_t rejected = 0;
+};
+
+/* Starts the frame of `cam` (initialised, with first hit distances `depth`)
+ * in `buffer` from the history. Every pixel's first hit is projected into
+ * the previous camera and the previous pixel means around it are blended
+ * bilinearly, leaving out pixels whose own first hit is not at the expected
+ * distance; pixels with no such neighbour were disoccluded and start empty.
+ * Sky pixels reproject by direction alone. Pixels on depth edges and on
+ * view dependent materials, whose history would not match, start empty too.
+ *
+ * Reused pixels carry the blended sample count, capped at `max_samples`, so
+ * that a render to more than `max_samples` still adds fresh samples to all
+ * of them and old samples fade out at a bounded rate.
+ */
+reprojection_stats reproject(const frame_history& history,
+                             const cu_camera& cam,
+                             const std::vector<float>& depth,
+                             unsigned int max_samples, render_buffer& buffer);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/* Image textures are stored as mip pyramids cut into square tiles of
+ * `texture_tile_size` texels, each tile contiguous in memory, so that a
+ * bilinear lookup touches one or a few tiles and a texture can be paged into
+ * the device tile by tile (see texture_cache.hpp).
+ */
+constexpr int texture_tile_size = 32;
+constexpr int texture_tile_texels = texture_tile_size * texture_tile_size;
+
+// Gamma encoded (as written by write_color) 8-bit color; `a` is padding.
+struct texel {
+    unsigned char r, g, b, a;
+};
+
+struct texture_level {
+    int width, height;
+    int tiles_x;     // Tiles per row
+    int first_tile;  // Index of the level's first tile in the texture
+};
+
+struct rgb_image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgb;  // Row major, 3 bytes per pixel
+};
+
+// Reads a PPM image, ASCII (P3) or binary (P6), with up to 8 bits per channel.
+bool load_ppm(const std::string& path, rgb_image& image);
+
+/* Mip levels from the full image down to 1x1, each half the size (rounded up)
+ * of the one before and box filtered in linear space. Tiles are stored level
+ * by level, row by row; texels beyond the level edge repeat the edge.
+ */
+struct texture_pyramid {
+    std::vector<texture_level> levels;
+    std::vector<texel> tiles;  // texture_tile_texels per tile
+
+    size_t num_tiles() const { return tiles.size() / texture_tile_texels; }
+};
+
+texture_pyramid build_pyramid(const rgb_image& image);
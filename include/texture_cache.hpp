@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "texture.hpp"
+
+/* Page table of one image texture, read by cu_image_texture. Lookups need no
+ * locks: a kernel reads the slot of a tile and either finds it resident or
+ * marks it requested; the table only changes between launches.
+ */
+struct texture_pages {
+    texture_level* levels = nullptr;
+    int num_levels = 0;
+    int* tile_slot = nullptr;         // Cache slot per tile or -1
+    unsigned int* requests = nullptr;  // Set by lookups missing a tile
+    unsigned int* touched = nullptr;   // Set by lookups using a tile
+    const texel* slots = nullptr;     // The cache, shared by all textures
+};
+
+struct texture_cache_stats {
+    unsigned long long tiles = 0;           // Tiles of all textures
+    unsigned long long cache_tiles = 0;     // Device cache capacity
+    unsigned long long resident_tiles = 0;  // Currently in the cache
+    unsigned long long loads = 0;           // Tiles uploaded so far
+    unsigned long long evictions = 0;
+};
+
+/* Fixed size device cache of texture tiles, shared by all image textures of
+ * a scene. The single tile coarse levels of every texture stay resident, so a
+ * lookup can always fall back to a coarser level when its tile is missing;
+ * the missing tile is requested and uploaded by service() before the next
+ * pass. Textures are uploaded coarse to fine while there is room, so scenes
+ * whose textures fit the cache never miss.
+ */
+class texture_cache {
+   public:
+    texture_cache() {}
+    ~texture_cache();
+
+    texture_cache(const texture_cache&) = delete;
+    texture_cache& operator=(const texture_cache&) = delete;
+
+    // Sets up a device cache of `cache_bytes`.
+    bool open(size_t cache_bytes);
+
+    // Adds a texture and fills `pages` with its device side page table.
+    bool add(texture_pyramid pyramid, texture_pages*& pages);
+
+    /* Uploads the tiles requested since the last call, evicting the least
+     * recently used ones when the cache is full. Call between launches.
+     * Returns the number of tiles uploaded.
+     */
+    size_t service();
+
+    texture_cache_stats stats() const;
+
+    bool is_open() const { return d_slots != nullptr; }
+
+   private:
+    struct texture_entry {
+        texture_pyramid pyramid;
+        texture_pages* pages;
+    };
+
+    // Undoes a failed add() of the last texture, freeing its slots.
+    void remove_last();
+    int take_slot();
+    void load(size_t texture, int tile, int slot);
+
+    texel* d_slots = nullptr;
+    size_t cache_tiles = 0;
+    std::vector<texture_entry> textures;
+    std::vector<long long> slot_owner;  // texture << 32 | tile, or -1
+    std::vector<unsigned char> locked;  // Coarse levels, never evicted
+    std::vector<unsigned char> pinned;  // Filled by the current service()
+    std::vector<int> free_slots;
+    size_t clock_hand = 0;
+    texture_cache_stats counters;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "numa.hpp"
+#include "trace.hpp"
+
+/* Fixed size pool of worker threads running prioritised tasks. Tasks with a
+ * higher priority run first, tasks of equal priority in submission order.
+ * All render jobs of a process share the pool returned by global(), so
+ * concurrent jobs never run more threads than there are cores.
+ *
+ * With `nodes` > 1 the workers are spread round robin over the NUMA nodes
+ * and pinned there. Tasks submitted for a node run on its workers, which
+ * only take tasks of other nodes when they have nothing else to do.
+ */
+class thread_pool {
+   public:
+    explicit thread_pool(unsigned int num_threads, size_t nodes = 1)
+        : queues(nodes + 1) {
+        if (num_threads == 0) num_threads = 1;
+        for (unsigned int i = 0; i < num_threads; i++) {
+            int node = nodes > 1 ? int(i % nodes) : -1;
+            workers.emplace_back([this, node, i] {
+                trace::set_thread_name("worker " + std::to_string(i));
+                if (node >= 0 && pin_thread_to_node(node)) worker_node() = node;
+                worker_loop(node);
+            });
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    static thread_pool& global() {
+        static thread_pool pool(std::thread::hardware_concurrency(),
+                                numa_topology::system().nodes());
+        return pool;
+    }
+
+    // Queues `fn`, preferably for a worker of NUMA node `node` (-1: any).
+    void submit(int priority, std::function<void()> fn, int node = -1) {
+        size_t queue = node >= 0 && size_t(node) + 1 < queues.size()
+                           ? size_t(node)
+                           : queues.size() - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queues[queue].push(task{priority, next_sequence++, std::move(fn)});
+            pending++;
+        }
+        // Wake everyone for node tasks, the first woken worker might belong
+        // to another node.
+        if (queue + 1 < queues.size())
+            wake.notify_all();
+        else
+            wake.notify_one();
+    }
+
+    size_t size() const { return workers.size(); }
+
+    // NUMA nodes the workers are spread over (1 when not pinned).
+    size_t nodes() const { return std::max<size_t>(1, queues.size() - 1); }
+
+    // Node the calling worker is pinned to, -1 outside pinned workers.
+    static int current_node() { return worker_node(); }
+
+   private:
+    struct task {
+        int priority;
+        unsigned long long sequence;
+        std::function<void()> fn;
+
+        bool operator<(const task& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return sequence > other.sequence;
+        }
+    };
+
+    static int& worker_node() {
+        static thread_local int node = -1;
+        return node;
+    }
+
+    // Picks the queue to run next from: the best task of the own node or
+    // the shared queue, else the best task of any other node.
+    size_t pick_queue(int node) const {
+        size_t shared = queues.size() - 1;
+        size_t best = shared;
+        if (node >= 0 && !queues[node].empty() &&
+            (queues[shared].empty() || queues[shared].top() < queues[node].top()))
+            best = node;
+        if (!queues[best].empty()) return best;
+
+        for (size_t q = 0; q < shared; q++)
+            if (!queues[q].empty() &&
+                (queues[best].empty() || queues[best].top() < queues[q].top()))
+                best = q;
+        return best;
+    }
+
+    void worker_loop(int node) {
+        while (true) {
+            task next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || pending > 0; });
+                if (stopping && pending == 0) return;
+                auto& queue = queues[pick_queue(node)];
+                next = queue.top();
+                queue.pop();
+                pending--;
+            }
+            next.fn();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::priority_queue<task>> queues;  // Per node, then shared
+    size_t pending = 0;
+    std::mutex mutex;
+    std::condition_variable wake;
+    unsigned long long next_sequence = 0;
+    bool stopping = false;
+};
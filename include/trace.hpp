@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+
+/* Timeline tracing of render stages, dumped in the Chrome trace event format
+ * (open in chrome://tracing or ui.perfetto.dev). Built only with
+ * -DENABLE_TRACING=ON; otherwise the macros expand to nothing.
+ *
+ *     TRACE_SCOPE("bvh build");            // Event from here to scope exit
+ *     TRACE_SCOPE_ARG("tile", "index", i); // With one integer argument
+ *
+ * Names must be string literals. Every thread records into a ring buffer of
+ * its own, without locks; when a buffer wraps, its oldest events are lost.
+ */
+
+#ifdef RT_TRACING
+
+#include <chrono>
+
+namespace trace {
+
+using clock = std::chrono::steady_clock;
+
+void record(const char* name, const char* arg_name, long long arg,
+            clock::time_point start, clock::time_point end);
+
+class scope {
+   public:
+    explicit scope(const char* name, const char* arg_name = nullptr,
+                   long long arg = 0)
+        : name(name), arg_name(arg_name), arg(arg), start(clock::now()) {}
+    ~scope() { record(name, arg_name, arg, start, clock::now()); }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+   private:
+    const char* name;
+    const char* arg_name;
+    long long arg;
+    clock::time_point start;
+};
+
+// Names the calling thread in the trace.
+void set_thread_name(const std::string& name);
+
+// Writes all recorded events to `path`. Call once the traced threads are idle.
+bool dump(const std::string& path);
+
+}  // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) \
+    trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg_name, arg)
+
+#else
+
+namespace trace {
+
+inline void set_thread_name(const std::string&) {}
+inline bool dump(const std::string&) { return false; }
+
+}  // namespace trace
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg_name, arg)
+
+#endif
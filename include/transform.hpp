@@ -0,0 +1,121 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "vec3.hpp"
+
+/* Affine transform stored as the top three rows of a 4x4 matrix: a linear
+ * part m[i][0..2] and a translation m[i][3].
+ */
+class transform {
+   public:
+    double m[3][4];
+
+    HD transform() {
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++) m[i][j] = (i == j) ? 1.0 : 0.0;
+    }
+
+    static transform translate(const vec3& offset) {
+        transform t;
+        for (int i = 0; i < 3; i++) t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static transform scale(double s) { return scale(vec3(s, s, s)); }
+
+    static transform scale(const vec3& s) {
+        transform t;
+        for (int i = 0; i < 3; i++) t.m[i][i] = s[i];
+        return t;
+    }
+
+    // Rotation by `degrees` around the (not necessarily unit) `axis`.
+    static transform rotate(const vec3& axis, double degrees) {
+        vec3 a = unit_vector(axis);
+        double c = cos(degrees_to_radians(degrees));
+        double s = sin(degrees_to_radians(degrees));
+        double k = 1 - c;
+
+        transform t;
+        t.m[0][0] = c + a[0] * a[0] * k;
+        t.m[0][1] = a[0] * a[1] * k - a[2] * s;
+        t.m[0][2] = a[0] * a[2] * k + a[1] * s;
+        t.m[1][0] = a[1] * a[0] * k + a[2] * s;
+        t.m[1][1] = c + a[1] * a[1] * k;
+        t.m[1][2] = a[1] * a[2] * k - a[0] * s;
+        t.m[2][0] = a[2] * a[0] * k - a[1] * s;
+        t.m[2][1] = a[2] * a[1] * k + a[0] * s;
+        t.m[2][2] = c + a[2] * a[2] * k;
+        return t;
+    }
+
+    // Composition: (a * b) applies b first, then a.
+    friend transform operator*(const transform& a, const transform& b) {
+        transform t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                t.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+                            a.m[i][2] * b.m[2][j];
+            }
+            t.m[i][3] += a.m[i][3];
+        }
+        return t;
+    }
+
+    transform inverse() const {
+        // Inverse of the linear part by cofactors, then undo the translation.
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                     m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                     m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double inv_det = 1.0 / det;
+
+        transform t;
+        t.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        t.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        t.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        t.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        t.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        t.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        t.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        t.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        t.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] +
+                          t.m[i][2] * m[2][3]);
+        return t;
+    }
+
+    HD point3 apply_point(const point3& p) const {
+        return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                      m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                      m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    HD vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // Multiplies by the transposed linear part. Called on the inverse
+    // transform this maps normals from object to world space.
+    HD vec3 apply_transposed(const vec3& n) const {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // Box around the transformed corners of `box`.
+    aabb apply_box(const aabb& box) const {
+        aabb result;
+        for (int c = 0; c < 8; c++) {
+            point3 corner((c & 1) ? box.x.max : box.x.min,
+                          (c & 2) ? box.y.max : box.y.min,
+                          (c & 4) ? box.z.max : box.z.min);
+            point3 p = apply_point(corner);
+            result = aabb(result, aabb(p, p));
+        }
+        return result;
+    }
+};
@@ -4,42 +4,61 @@
 #include <cmath>
 #include <iostream>
 
+#include "simd.hpp"
 #include "utils.hpp"
 
 class vec3 {
    public:
+#ifdef RT_SIMD_VEC3
+    // x, y, z and a zero pad, so that host code can work on whole vectors
+    // with SIMD instructions (see simd.hpp). The layout is the same on the
+    // device, where the pad is never touched by arithmetic.
+    alignas(16) double e[4];
+#else
     double e[3];
+#endif
 
-    HD vec3() {
-        e[0] = 0.0;
-        e[1] = 0.0;
-        e[2] = 0.0;
-    }
-    HD vec3(double e0, double e1, double e2) {
-        e[0] = e0;
-        e[1] = e1;
-        e[2] = e2;
-    }
+    HD vec3() : e{0.0, 0.0, 0.0} {}
+    HD vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+
+#ifdef VEC3_SIMD
+    explicit vec3(simd::lanes v) { simd::store(e, v); }
+    simd::lanes lanes() const { return simd::load(e); }
+#endif
 
     HD double x() const { return e[0]; }
     HD double y() const { return e[1]; }
     HD double z() const { return e[2]; }
 
-    HD vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+    HD vec3 operator-() const {
+#ifdef VEC3_SIMD
+        return vec3(simd::neg(lanes()));
+#else
+        return vec3(-e[0], -e[1], -e[2]);
+#endif
+    }
     HD double operator[](int i) const { return e[i]; }
     HD double& operator[](int i) { return e[i]; }
 
     HD vec3& operator+=(const vec3& v) {
+#ifdef VEC3_SIMD
+        simd::store(e, simd::add(lanes(), v.lanes()));
+#else
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
+#endif
         return *this;
     }
 
     HD vec3& operator*=(double t) {
+#ifdef VEC3_SIMD
+        simd::store(e, simd::mul(lanes(), simd::splat(t)));
+#else
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
+#endif
         return *this;
     }
 
@@ -48,7 +67,12 @@ class vec3 {
     HD double length() const { return sqrt(length_squared()); }
 
     HD double length_squared() const {
+#ifdef VEC3_SIMD
+        simd::lanes v = lanes();
+        return simd::dot(v, v);
+#else
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+#endif
     }
 
     HD bool near_zero() const {
@@ -78,19 +102,35 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
 }
 
 HD inline vec3 operator+(const vec3& u, const vec3& v) {
+#ifdef VEC3_SIMD
+    return vec3(simd::add(u.lanes(), v.lanes()));
+#else
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+#endif
 }
 
 HD inline vec3 operator-(const vec3& u, const vec3& v) {
+#ifdef VEC3_SIMD
+    return vec3(simd::sub(u.lanes(), v.lanes()));
+#else
     return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+#endif
 }
 
 HD inline vec3 operator*(const vec3& u, const vec3& v) {
+#ifdef VEC3_SIMD
+    return vec3(simd::mul(u.lanes(), v.lanes()));
+#else
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+#endif
 }
 
 HD inline vec3 operator*(double t, const vec3& v) {
+#ifdef VEC3_SIMD
+    return vec3(simd::mul(simd::splat(t), v.lanes()));
+#else
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+#endif
 }
 
 HD inline vec3 operator*(const vec3& v, double t) { return t * v; }
@@ -98,9 +138,14 @@ HD inline vec3 operator*(const vec3& v, double t) { return t * v; }
 HD inline vec3 operator/(const vec3& v, double t) { return (1 / t) * v; }
 
 HD inline double dot(const vec3& u, const vec3& v) {
+#ifdef VEC3_SIMD
+    return simd::dot(u.lanes(), v.lanes());
+#else
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+#endif
 }
 
+// Scalar everywhere: the lane shuffles cost more than the three products.
 HD inline vec3 cross(const vec3& u, const vec3& v) {
     return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
                 u.e[2] * v.e[0] - u.e[0] * v.e[2],
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "aabb.hpp"
+
+/* Densities on a regular grid over `bounds`, one value per voxel center, x
+ * varying fastest. Lookups between centers interpolate trilinearly.
+ */
+struct density_grid {
+    int nx = 0, ny = 0, nz = 0;
+    aabb bounds;
+    std::vector<float> values;
+};
+
+// Reads the first channel of a Mitsuba gridvolume (.vol, float32).
+bool load_density_grid(const std::string& path, density_grid& grid);
+
+/* Upper bounds of the interpolated density over blocks of `block` voxels
+ * cubed, for delta tracking (see cu_medium). Each block also covers the
+ * voxels around it that interpolation reaches into, so no lookup inside a
+ * block exceeds its majorant; blocks of empty space get 0.
+ */
+struct majorant_grid {
+    int nx = 0, ny = 0, nz = 0;
+    int block = 0;
+    std::vector<float> values;
+};
+
+majorant_grid build_majorants(const density_grid& grid, int block);
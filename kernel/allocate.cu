@@ -1,15 +1,47 @@
 #include <cuda_runtime_api.h>
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
+#include <unordered_map>
 #include "color.hpp"
 #include "cuda/cu_camera.hpp"
 #include "cuda/cu_hittable.hpp"
 #include "cuda/cu_hittable_list.hpp"
 #include "cuda/cu_material.hpp"
+#include "cuda/cu_medium.hpp"
 #include "cuda/cu_sphere.hpp"
 #include "cuda/cu_allocate.hpp"
+#include "cuda/cu_bvh.hpp"
+#include "cuda/cu_instance.hpp"
+#include "cuda/cu_mesh.hpp"
+#include "cuda/cu_paged_sphere_cloud.hpp"
+#include "cuda/cu_render.hpp"
+#include "cuda/cu_sphere_cloud.hpp"
 #include "utils.hpp"
 
+/* Levels of instances inside every object that holds any, whichever
+ * Allocator built it: one for an instance of a plain object, and the deepest
+ * of their contents for lists and hierarchies. A hit records one transform
+ * per level, so allocate_instance refuses to go past cu_hit::max_instances.
+ */
+static std::unordered_map<cu_hittable**, int>& instance_depths() {
+    static std::unordered_map<cu_hittable**, int> depths;
+    return depths;
+}
+
+static int instance_depth(cu_hittable** object) {
+    auto it = instance_depths().find(object);
+    return it == instance_depths().end() ? 0 : it->second;
+}
+
+static void set_instance_depth(cu_hittable** object,
+                               const std::vector<cu_hittable**>& contents) {
+    int depth = 0;
+    for (cu_hittable** h : contents)
+        depth = std::max(depth, instance_depth(h));
+    if (depth > 0) instance_depths()[object] = depth;
+}
+
 __global__ void cu_allocate_sphere(const point3* center, double radius,
                                    cu_material** mat,
                                    cu_hittable** sphere_ptr) {
@@ -47,6 +79,8 @@ cu_hittable** Allocator::allocate_sphere(const point3 center, double radius,
     }
 
     allocated_hittables.push_back(d_sphere);
+    vec3 extent(radius, radius, radius);
+    allocated_boxes.push_back(aabb(center - extent, center + extent));
     return d_sphere;
 }
 
@@ -59,19 +93,21 @@ __global__ void cu_allocate_list(cu_hittable*** d_objects, int d_num_objects,
 
 __global__ void render(cu_hittable** d_world, cu_camera* d_cam,
                        color3* d_output) {
-    d_cam->initRandState();
+    curandState rand_state;
+    curand_init(42, 0, 0, &rand_state);
 
     int width = d_cam->image_width;
     int height = d_cam->image_height;
 
     for (int i = 0; i < height; i++) {
         for (int j = 0; j < width; j++) {
-            ray ray = d_cam->get_ray(i, j);
+            ray ray = d_cam->get_ray(i, j, &rand_state);
             // printf("Ray: %f, %f, %f\n", ray.direction().x(),
             // ray.direction().y(),
             //        ray.direction().z());
             printf("%d, %d\n", i, j);
-            color3 op = d_cam->ray_color_iter(ray, *d_world, d_cam->max_depth);
+            color3 op = d_cam->ray_color_iter(ray, *d_world, d_cam->max_depth,
+                                              &rand_state);
             d_output[i * width + j] = op;
         }
     }
@@ -89,10 +125,14 @@ __global__ void render_parallel(cu_hittable** d_world, cu_camera* d_cam,
 
     if (x >= height || y >= width) return;
 
+    curandState rand_state;
+    curand_init(sample_seed(42, x * width + y, 0), 0, 0, &rand_state);
+
     color3 op = color3(0, 0, 0);
     for (int i = 0; i < d_cam->samples_per_pixel; i++) {
-        auto ray = d_cam->get_ray(y, x);
-        op += d_cam->ray_color_iter(ray, *d_world, d_cam->max_depth);
+        auto ray = d_cam->get_ray(y, x, &rand_state);
+        op += d_cam->ray_color_iter(ray, *d_world, d_cam->max_depth,
+                                    &rand_state);
     }
 
     op *= d_cam->pixel_samples_scale;
@@ -169,13 +209,15 @@ cu_hittable** Allocator::allocate_list() {
         return nullptr;
     }
 
+    set_instance_depth(d_hittable_list, allocated_hittables);
     this->world = d_hittable_list;
     return d_hittable_list;
 }
 
-__global__ void cu_allocate_lambertian(color3* albedo,
+__global__ void cu_allocate_lambertian(color3* albedo, int id,
                                        cu_material** material_ptr) {
     *material_ptr = new cu_lambertian(*albedo);
+    (*material_ptr)->set_id(id);
 }
 
 cu_material** Allocator::allocate_lambertian(color3 albedo) {
@@ -194,7 +236,8 @@ cu_material** Allocator::allocate_lambertian(color3 albedo) {
     cudaMallocManaged(&d_color, sizeof(color3));
     *d_color = albedo;
 
-    cu_allocate_lambertian<<<1, 1>>>(d_color, lambertian_ptr);
+    cu_allocate_lambertian<<<1, 1>>>(d_color, allocated_materials.size(),
+                                     lambertian_ptr);
 
     err = cudaDeviceSynchronize();
     if (err != cudaSuccess) {
@@ -204,12 +247,177 @@ cu_material** Allocator::allocate_lambertian(color3 albedo) {
     }
 
     allocated_materials.push_back(lambertian_ptr);
+    material_kinds |= kind_lambertian;
     return lambertian_ptr;
 }
 
-__global__ void cu_allocate_metal(color3* albedo, double fuzz,
+__global__ void cu_allocate_textured_lambertian(cu_texture** texture, int id,
+                                                cu_material** material_ptr) {
+    *material_ptr = new cu_lambertian(*texture);
+    (*material_ptr)->set_id(id);
+}
+
+cu_material** Allocator::allocate_lambertian(cu_texture** texture) {
+    cu_material** lambertian_ptr;
+
+    auto err = cudaMallocManaged(&lambertian_ptr, sizeof(cu_material*));
+    if (err != cudaSuccess) {
+        std::cerr
+            << "Could not allocate material:lambertian ::cudaMalloc failed"
+            << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_textured_lambertian<<<1, 1>>>(
+        texture, allocated_materials.size(), lambertian_ptr);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct material:lambertian" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    allocated_materials.push_back(lambertian_ptr);
+    material_kinds |= kind_lambertian;
+    return lambertian_ptr;
+}
+
+__global__ void cu_allocate_image_texture(const texture_pages* pages,
+                                          cu_texture** texture_ptr) {
+    *texture_ptr = new cu_image_texture(pages);
+}
+
+cu_texture** Allocator::allocate_image_texture(const std::string& path) {
+    rgb_image image;
+    if (!load_ppm(path, image)) return nullptr;
+
+    if (textures == nullptr) {
+        textures = std::make_unique<texture_cache>();
+        if (!textures->open(texture_cache_bytes)) {
+            textures.reset();
+            return nullptr;
+        }
+    }
+
+    texture_pages* pages;
+    if (!textures->add(build_pyramid(image), pages)) return nullptr;
+
+    cu_texture** texture_ptr;
+    auto err = cudaMallocManaged(&texture_ptr, sizeof(cu_texture*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate texture ::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_image_texture<<<1, 1>>>(pages, texture_ptr);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct image texture" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+    return texture_ptr;
+}
+
+__global__ void cu_allocate_noise_texture(double scale, color3 color,
+                                          cu_texture** texture_ptr) {
+    *texture_ptr = new cu_noise_texture(scale, color);
+}
+
+cu_texture** Allocator::allocate_noise_texture(double scale,
+                                               const color3& color) {
+    cu_texture** texture_ptr;
+    auto err = cudaMallocManaged(&texture_ptr, sizeof(cu_texture*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate texture ::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_noise_texture<<<1, 1>>>(scale, color, texture_ptr);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct noise texture" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+    return texture_ptr;
+}
+
+const cu_environment* Allocator::allocate_environment(
+    const std::string& path) {
+    hdr_image image;
+    if (!load_hdr_image(path, image)) return nullptr;
+    environment_map env = build_environment(std::move(image));
+
+    cu_environment* d_env;
+    float *d_rgb, *d_rows, *d_columns;
+    auto err = cudaMallocManaged(&d_env, sizeof(cu_environment));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_rgb, env.image.rgb.size() * sizeof(float));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_rows, env.row_cdf.size() * sizeof(float));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_columns,
+                                env.column_cdf.size() * sizeof(float));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate environment ::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    std::copy(env.image.rgb.begin(), env.image.rgb.end(), d_rgb);
+    std::copy(env.row_cdf.begin(), env.row_cdf.end(), d_rows);
+    std::copy(env.column_cdf.begin(), env.column_cdf.end(), d_columns);
+    d_env->width = env.image.width;
+    d_env->height = env.image.height;
+    d_env->rgb = d_rgb;
+    d_env->row_cdf = d_rows;
+    d_env->column_cdf = d_columns;
+    return d_env;
+}
+
+cu_irradiance_cache* Allocator::allocate_irradiance_cache(
+    const cu_camera& cam, double cell_pixels, unsigned int cells) {
+    if (cells == 0 || (cells & (cells - 1)) != 0) {
+        std::cerr << "Irradiance cache size must be a power of two"
+                  << std::endl;
+        return nullptr;
+    }
+
+    cu_irradiance_cache* d_cache;
+    irradiance_cell* d_cells;
+    auto err = cudaMallocManaged(&d_cache, sizeof(cu_irradiance_cache));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_cells, cells * sizeof(irradiance_cell));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate irradiance cache ::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    std::fill(d_cells, d_cells + cells, irradiance_cell{});
+    *d_cache = cu_irradiance_cache();
+    d_cache->cells = d_cells;
+    d_cache->capacity = cells;
+    d_cache->eye = cam.center;
+    d_cache->cell_scale = cell_pixels * cam.pixel_spread;
+    return d_cache;
+}
+
+__global__ void cu_allocate_metal(color3* albedo, double fuzz, int id,
                                   cu_material** material_ptr) {
     *material_ptr = new cu_metal(*albedo, fuzz);
+    (*material_ptr)->set_id(id);
 }
 
 cu_material** Allocator::allocate_metal(const color3 albedo, double fuzz) {
@@ -226,7 +434,8 @@ cu_material** Allocator::allocate_metal(const color3 albedo, double fuzz) {
     cudaMallocManaged(&d_color, sizeof(color3));
     *d_color = albedo;
 
-    cu_allocate_metal<<<1, 1>>>(d_color, fuzz, metal_ptr);
+    cu_allocate_metal<<<1, 1>>>(d_color, fuzz, allocated_materials.size(),
+                                metal_ptr);
 
     err = cudaDeviceSynchronize();
     if (err != cudaSuccess) {
@@ -236,12 +445,14 @@ cu_material** Allocator::allocate_metal(const color3 albedo, double fuzz) {
     }
 
     allocated_materials.push_back(metal_ptr);
+    material_kinds |= kind_metal;
     return metal_ptr;
 }
 
-__global__ void cu_allocate_dielectric(double refraction_index,
+__global__ void cu_allocate_dielectric(double refraction_index, int id,
                                        cu_material** material_ptr) {
     *material_ptr = new cu_dielectric(refraction_index);
+    (*material_ptr)->set_id(id);
 }
 
 cu_material** Allocator::allocate_dielectric(double refraction_index) {
@@ -254,7 +465,9 @@ cu_material** Allocator::allocate_dielectric(double refraction_index) {
         return nullptr;
     }
 
-    cu_allocate_dielectric<<<1, 1>>>(refraction_index, dielectric_ptr);
+    cu_allocate_dielectric<<<1, 1>>>(refraction_index,
+                                     allocated_materials.size(),
+                                     dielectric_ptr);
 
     err = cudaDeviceSynchronize();
     if (err != cudaSuccess) {
@@ -264,5 +477,474 @@ cu_material** Allocator::allocate_dielectric(double refraction_index) {
     }
 
     allocated_materials.push_back(dielectric_ptr);
+    material_kinds |= kind_dielectric;
     return dielectric_ptr;
 }
+
+__global__ void cu_allocate_isotropic(color3 albedo, int id,
+                                      cu_material** material_ptr) {
+    *material_ptr = new cu_isotropic(albedo);
+    (*material_ptr)->set_id(id);
+}
+
+cu_material** Allocator::allocate_isotropic(const color3 albedo) {
+    cu_material** isotropic_ptr;
+
+    auto err = cudaMallocManaged(&isotropic_ptr, sizeof(cu_material*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate item::cudaMalloc failed" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_isotropic<<<1, 1>>>(albedo, allocated_materials.size(),
+                                    isotropic_ptr);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate item" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    allocated_materials.push_back(isotropic_ptr);
+    material_kinds |= kind_isotropic;
+    return isotropic_ptr;
+}
+
+__global__ void cu_edit_material(cu_material** material_ptr, color3 albedo,
+                                 double param) {
+    (*material_ptr)->set_params(albedo, param);
+}
+
+bool Allocator::edit_material(cu_material** mat, const color3& albedo,
+                              double param) {
+    cu_edit_material<<<1, 1>>>(mat, albedo, param);
+
+    auto err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not edit material" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+unsigned long long Allocator::material_mask(cu_material** mat) const {
+    for (size_t i = 0; i < allocated_materials.size(); i++)
+        if (allocated_materials[i] == mat) return 1ull << (i % 64);
+    return 0;
+}
+
+__global__ void cu_allocate_bvh(const bvh_node* d_nodes,
+                                cu_hittable*** d_objects,
+                                cu_hittable** bvh_ptr) {
+    *bvh_ptr = new cu_bvh(d_nodes, d_objects);
+}
+
+cu_hittable** Allocator::allocate_bvh() {
+    // The traversal takes a leaf without primitives for an internal node.
+    if (allocated_boxes.empty()) {
+        std::cerr << "Could not allocate bvh: no objects" << std::endl;
+        return nullptr;
+    }
+
+    std::vector<int> order;
+    std::vector<bvh_node> nodes = build_bvh(allocated_boxes, order);
+
+    cu_hittable** d_bvh;
+    auto err = cudaMallocManaged(&d_bvh, sizeof(cu_hittable*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate bvh ::cudaMalloc failed" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    bvh_node* d_nodes;
+    cu_hittable*** d_objects;
+    err = cudaMallocManaged(&d_nodes, nodes.size() * sizeof(bvh_node));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_objects,
+                                order.size() * sizeof(cu_hittable**));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate bvh nodes ::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    std::copy(nodes.begin(), nodes.end(), d_nodes);
+    for (size_t i = 0; i < order.size(); i++)
+        d_objects[i] = allocated_hittables[order[i]];
+
+    cu_allocate_bvh<<<1, 1>>>(d_nodes, d_objects, d_bvh);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct bvh" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    set_instance_depth(d_bvh, allocated_hittables);
+    this->world = d_bvh;
+    return d_bvh;
+}
+
+__global__ void cu_allocate_instance(cu_hittable** object,
+                                     transform object_to_world,
+                                     transform world_to_object,
+                                     cu_material** mat,
+                                     cu_hittable** instance_ptr) {
+    *instance_ptr = new cu_instance(object, object_to_world, world_to_object,
+                                    mat ? *mat : nullptr);
+}
+
+cu_hittable** Allocator::allocate_instance(cu_hittable** object,
+                                           const aabb& object_box,
+                                           const transform& object_to_world,
+                                           cu_material** mat) {
+    int depth = instance_depth(object) + 1;
+    if (depth > cu_hit::max_instances) {
+        std::cerr << "Could not allocate instance: instances nest at most "
+                  << cu_hit::max_instances << " deep" << std::endl;
+        return nullptr;
+    }
+
+    cu_hittable** d_instance;
+
+    auto err = cudaMallocManaged(&d_instance, sizeof(cu_hittable*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate instance::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_instance<<<1, 1>>>(object, object_to_world,
+                                   object_to_world.inverse(), mat, d_instance);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct instance on device" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    instance_depths()[d_instance] = depth;
+    allocated_hittables.push_back(d_instance);
+    allocated_boxes.push_back(object_to_world.apply_box(object_box));
+    return d_instance;
+}
+
+aabb Allocator::bounds() const {
+    aabb box;
+    for (const aabb& b : allocated_boxes) box = aabb(box, b);
+    return box;
+}
+
+__global__ void cu_allocate_sphere_cloud(const cloud_node* d_nodes,
+                                         const sphere_frame* d_frames,
+                                         const packed_sphere* d_spheres,
+                                         cu_material** d_materials,
+                                         cu_hittable** cloud_ptr) {
+    *cloud_ptr =
+        new cu_sphere_cloud(d_nodes, d_frames, d_spheres, d_materials);
+}
+
+cu_hittable** Allocator::allocate_sphere_cloud(
+    std::vector<sphere_input>& spheres,
+    const std::vector<cu_material**>& materials) {
+    // The device looks materials up without bounds checks.
+    for (const sphere_input& s : spheres)
+        if (s.material >= materials.size()) {
+            std::cerr << "Could not allocate sphere cloud: material index "
+                      << s.material << " out of " << materials.size()
+                      << std::endl;
+            return nullptr;
+        }
+
+    sphere_cloud_data cloud = build_sphere_cloud(spheres);
+    if (cloud.spheres.empty()) {
+        std::cerr << "Could not allocate sphere cloud: no spheres" << std::endl;
+        return nullptr;
+    }
+
+    cu_hittable** d_cloud;
+    cloud_node* d_nodes;
+    sphere_frame* d_frames;
+    packed_sphere* d_spheres;
+    cu_material** d_materials;
+
+    auto err = cudaMallocManaged(&d_cloud, sizeof(cu_hittable*));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_nodes,
+                                cloud.nodes.size() * sizeof(cloud_node));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_frames,
+                                cloud.frames.size() * sizeof(sphere_frame));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_spheres,
+                                cloud.spheres.size() * sizeof(packed_sphere));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_materials,
+                                materials.size() * sizeof(cu_material*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate sphere cloud::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    std::copy(cloud.nodes.begin(), cloud.nodes.end(), d_nodes);
+    std::copy(cloud.frames.begin(), cloud.frames.end(), d_frames);
+    std::copy(cloud.spheres.begin(), cloud.spheres.end(), d_spheres);
+    for (size_t i = 0; i < materials.size(); i++) d_materials[i] = *materials[i];
+
+    cu_allocate_sphere_cloud<<<1, 1>>>(d_nodes, d_frames, d_spheres,
+                                       d_materials, d_cloud);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct sphere cloud on device" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    allocated_hittables.push_back(d_cloud);
+    allocated_boxes.push_back(cloud.bounds);
+    return d_cloud;
+}
+
+__global__ void cu_allocate_mesh(const bvh_node* d_nodes,
+                                 const mesh_vertex* d_vertices,
+                                 const mesh_vertex* d_normals,
+                                 const mesh_triangle* d_triangles,
+                                 cu_material** mat, cu_hittable** mesh_ptr) {
+    *mesh_ptr = new cu_mesh(d_nodes, d_vertices, d_normals, d_triangles, *mat);
+}
+
+cu_hittable** Allocator::allocate_mesh(const triangle_mesh& mesh,
+                                       cu_material** mat) {
+    if (mesh.triangles.empty()) {
+        std::cerr << "Could not allocate mesh: no triangles" << std::endl;
+        return nullptr;
+    }
+
+    std::vector<aabb> boxes(mesh.triangles.size());
+    for (size_t i = 0; i < boxes.size(); i++) boxes[i] = mesh.triangle_box(i);
+
+    std::vector<int> order;
+    std::vector<bvh_node> nodes = build_bvh(boxes, order, 4);
+
+    cu_hittable** d_mesh;
+    bvh_node* d_nodes;
+    mesh_vertex* d_vertices;
+    mesh_vertex* d_normals = nullptr;
+    mesh_triangle* d_triangles;
+
+    auto err = cudaMallocManaged(&d_mesh, sizeof(cu_hittable*));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_nodes, nodes.size() * sizeof(bvh_node));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_vertices,
+                                mesh.vertices.size() * sizeof(mesh_vertex));
+    if (err == cudaSuccess && !mesh.normals.empty())
+        err = cudaMallocManaged(&d_normals,
+                                mesh.normals.size() * sizeof(mesh_vertex));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_triangles,
+                                order.size() * sizeof(mesh_triangle));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate mesh::cudaMalloc failed" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    std::copy(nodes.begin(), nodes.end(), d_nodes);
+    std::copy(mesh.vertices.begin(), mesh.vertices.end(), d_vertices);
+    std::copy(mesh.normals.begin(), mesh.normals.end(), d_normals);
+    for (size_t i = 0; i < order.size(); i++)
+        d_triangles[i] = mesh.triangles[order[i]];
+
+    cu_allocate_mesh<<<1, 1>>>(d_nodes, d_vertices, d_normals, d_triangles,
+                               mat, d_mesh);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct mesh on device" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    allocated_hittables.push_back(d_mesh);
+    allocated_boxes.push_back(mesh.bounds());
+    return d_mesh;
+}
+
+__global__ void cu_allocate_medium(cu_hittable** boundary,
+                                   cu_density_grid grid, double density,
+                                   cu_material** phase,
+                                   cu_hittable** medium_ptr) {
+    if (grid.density == nullptr)
+        *medium_ptr = new cu_medium(boundary, density, *phase);
+    else
+        *medium_ptr = new cu_medium(boundary, grid, density, *phase);
+}
+
+// Voxels per side of a majorant block. Smaller blocks fit the density more
+// tightly but cost more steps across them.
+static const int majorant_block = 8;
+
+static cu_hittable** construct_medium(cu_hittable** boundary,
+                                      const cu_density_grid& grid,
+                                      double density, cu_material** phase) {
+    cu_hittable** d_medium;
+    auto err = cudaMallocManaged(&d_medium, sizeof(cu_hittable*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate medium::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    cu_allocate_medium<<<1, 1>>>(boundary, grid, density, phase, d_medium);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct medium on device" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+    return d_medium;
+}
+
+cu_hittable** Allocator::allocate_medium(cu_hittable** boundary,
+                                         const aabb& boundary_box,
+                                         double density,
+                                         cu_material** phase) {
+    cu_hittable** d_medium =
+        construct_medium(boundary, cu_density_grid(), density, phase);
+    if (d_medium == nullptr) return nullptr;
+
+    allocated_hittables.push_back(d_medium);
+    allocated_boxes.push_back(boundary_box);
+    return d_medium;
+}
+
+cu_hittable** Allocator::allocate_medium(cu_hittable** boundary,
+                                         const aabb& boundary_box,
+                                         const density_grid& grid,
+                                         double scale, cu_material** phase) {
+    if (grid.values.empty()) {
+        std::cerr << "Could not allocate medium: empty density grid"
+                  << std::endl;
+        return nullptr;
+    }
+    majorant_grid majorants = build_majorants(grid, majorant_block);
+
+    float* d_density;
+    float* d_majorant;
+    auto err =
+        cudaMallocManaged(&d_density, grid.values.size() * sizeof(float));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_majorant,
+                                majorants.values.size() * sizeof(float));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate density grid::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+    std::copy(grid.values.begin(), grid.values.end(), d_density);
+    std::copy(majorants.values.begin(), majorants.values.end(), d_majorant);
+
+    cu_density_grid view;
+    view.nx = grid.nx;
+    view.ny = grid.ny;
+    view.nz = grid.nz;
+    view.density = d_density;
+    view.bounds = grid.bounds;
+    view.voxel = vec3(grid.bounds.x.size() / grid.nx,
+                      grid.bounds.y.size() / grid.ny,
+                      grid.bounds.z.size() / grid.nz);
+    view.block = majorants.block;
+    view.mx = majorants.nx;
+    view.my = majorants.ny;
+    view.mz = majorants.nz;
+    view.majorant = d_majorant;
+
+    cu_hittable** d_medium = construct_medium(boundary, view, scale, phase);
+    if (d_medium == nullptr) return nullptr;
+
+    // The medium only fills the part of the boundary inside the grid.
+    const aabb& g = grid.bounds;
+    allocated_hittables.push_back(d_medium);
+    allocated_boxes.push_back(
+        aabb(interval(fmax(g.x.min, boundary_box.x.min),
+                      fmin(g.x.max, boundary_box.x.max)),
+             interval(fmax(g.y.min, boundary_box.y.min),
+                      fmin(g.y.max, boundary_box.y.max)),
+             interval(fmax(g.z.min, boundary_box.z.min),
+                      fmin(g.z.max, boundary_box.z.max))));
+    return d_medium;
+}
+
+__global__ void cu_allocate_paged_sphere_cloud(
+    const cloud_node* d_nodes, const sphere_frame* d_frames,
+    const packed_sphere* d_slots, const int* brick_slot,
+    unsigned int* requests, unsigned int* touched,
+    unsigned int* const* fault_cell, cu_material** d_materials,
+    cu_hittable** cloud_ptr) {
+    *cloud_ptr = new cu_paged_sphere_cloud(d_nodes, d_frames, d_slots,
+                                           brick_slot, requests, touched,
+                                           fault_cell, d_materials);
+}
+
+cu_hittable** Allocator::allocate_paged_scene(paged_scene& scene) {
+    std::vector<cu_material**> materials;
+    for (unsigned int i = 0; i < scene.num_materials(); i++) {
+        const material_record& m = scene.materials()[i];
+        color3 albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        cu_material** mat;
+        if (m.type == material_metal)
+            mat = allocate_metal(albedo, m.param);
+        else if (m.type == material_dielectric)
+            mat = allocate_dielectric(m.param);
+        else
+            mat = allocate_lambertian(albedo);
+        if (mat == nullptr) return nullptr;
+        materials.push_back(mat);
+    }
+
+    cu_hittable** d_cloud;
+    cu_material** d_materials;
+    auto err = cudaMallocManaged(&d_cloud, sizeof(cu_hittable*));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_materials,
+                                materials.size() * sizeof(cu_material*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate paged scene::cudaMalloc failed"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+    for (size_t i = 0; i < materials.size(); i++) d_materials[i] = *materials[i];
+
+    cu_allocate_paged_sphere_cloud<<<1, 1>>>(
+        scene.d_nodes, scene.d_frames, scene.d_slots, scene.brick_slot,
+        scene.requests, scene.touched, scene.fault_cell, d_materials, d_cloud);
+
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess) {
+        std::cerr << "Could not construct paged scene on device" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return nullptr;
+    }
+
+    allocated_hittables.push_back(d_cloud);
+    allocated_boxes.push_back(scene.bounds());
+    this->pager = &scene;
+    this->world = d_cloud;
+    return d_cloud;
+}
@@ -0,0 +1,671 @@
+#include <cuda_runtime_api.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include "checkpoint.hpp"
+#include "cuda/cu_allocate.hpp"
+#include "cuda/cu_camera.hpp"
+#include "cuda/cu_render.hpp"
+#include "render_buffer.hpp"
+#include "trace.hpp"
+
+// Adds up to `num_samples` samples to pixel (i, j), stopping at
+// `target_samples`.
+template <unsigned int features>
+__device__ void render_pixel(cu_hittable** d_world, cu_camera* d_cam,
+                             const render_target& target, int i, int j,
+                             int num_samples, unsigned int target_samples) {
+    // Random streams follow the image pixel, so the buffer layout does not
+    // change the result.
+    size_t pixel = target.index(i, j);
+    unsigned long long image_pixel = (unsigned long long)j * target.width + i;
+    unsigned int first = target.samples[pixel];
+    if (first >= target_samples) return;
+
+    unsigned int count = min(target_samples - first, (unsigned int)num_samples);
+
+    unsigned int* fault = nullptr;
+    if (target.faults != nullptr) {
+        fault = &target.faults[launch_thread_index()];
+        *fault = 0;
+    }
+
+    vec3 normal_sum(0, 0, 0);
+    color3 albedo_sum(0, 0, 0);
+    unsigned long long materials = 0;
+    unsigned long long rays = 0;
+
+    color3 sum(0, 0, 0);
+    double sum_sq = 0;
+    unsigned int rendered = 0;
+    curandState rand_state;
+    for (unsigned int s = first; s < first + count; s++) {
+        curand_init(sample_seed(target.seed, image_pixel, s), 0, 0,
+                    &rand_state);
+        path_record record;
+        auto ray = d_cam->get_ray<features>(i, j, &rand_state);
+        color3 sample = d_cam->ray_color_iter<features>(
+            ray, *d_world, d_cam->max_depth, &rand_state, &record);
+        // Keep the samples before a fault; the rest are redone once the
+        // missing data is available, with the same random streams.
+        if (fault != nullptr && *fault) break;
+
+        if (features & feature_aov) {
+            normal_sum += record.normal;
+            albedo_sum += record.albedo;
+            materials |= record.materials;
+        }
+        if (features & feature_stats) rays += record.rays;
+
+        double l = luminance(sample);
+        sum += sample;
+        sum_sq += l * l;
+        rendered++;
+    }
+
+    target.accum[pixel] += sum;
+    target.lum_sq[pixel] += sum_sq;
+    target.samples[pixel] = first + rendered;
+
+    if (features & feature_aov) {
+        if (target.aov_normal != nullptr) target.aov_normal[pixel] += normal_sum;
+        if (target.aov_albedo != nullptr) target.aov_albedo[pixel] += albedo_sum;
+        if (target.material_masks != nullptr)
+            target.material_masks[pixel] |= materials;
+    }
+    if (features & feature_stats) atomicAdd(target.ray_count, rays);
+}
+
+template <unsigned int features>
+__global__ void render_pass(cu_hittable** d_world, cu_camera* d_cam,
+                            render_target target, tile region,
+                            int num_samples, unsigned int target_samples) {
+    int i = region.x0 + blockIdx.x * blockDim.x + threadIdx.x;  // column
+    int j = region.y0 + blockIdx.y * blockDim.y + threadIdx.y;  // row
+
+    if (i >= region.x1 || j >= region.y1) return;
+
+    render_pixel<features>(d_world, d_cam, target, i, j, num_samples,
+                           target_samples);
+}
+
+// Renders the listed pixels (indices into the target's window), each up to
+// its own sample count in `goals`.
+template <unsigned int features>
+__global__ void render_pixel_list(cu_hittable** d_world, cu_camera* d_cam,
+                                  render_target target,
+                                  const unsigned int* pixels,
+                                  const unsigned int* goals, int count,
+                                  int num_samples) {
+    int k = blockIdx.x * blockDim.x + threadIdx.x;
+    if (k >= count) return;
+
+    int i = target.window.x0 + pixels[k] % target.window.width();
+    int j = target.window.y0 + pixels[k] / target.window.width();
+    render_pixel<features>(d_world, d_cam, target, i, j, num_samples,
+                           goals[k]);
+}
+
+// See Allocator::render_depth.
+__global__ void first_hit_depth(cu_hittable** d_world, cu_camera* d_cam,
+                                float* depth) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    int j = blockIdx.y * blockDim.y + threadIdx.y;
+    if (i >= d_cam->image_width || j >= d_cam->image_height) return;
+
+    vec3 direction = d_cam->pixel00_loc + i * d_cam->pixel_delta_u +
+                     j * d_cam->pixel_delta_v - d_cam->center;
+    float& d = depth[size_t(j) * d_cam->image_width + i];
+    cu_hit_record rec;
+    if (!(*d_world)->hit(ray(d_cam->center, direction), interval(0.001, inf),
+                         rec))
+        d = INFINITY;
+    else if (rec.mat->kind() != kind_lambertian && d_cam->ao_distance <= 0)
+        d = NAN;
+    else
+        d = float(rec.t * direction.length());
+}
+
+std::vector<tile> make_tiles(int width, int height, int size) {
+    std::vector<tile> tiles;
+    if (size < 1) return tiles;
+    for (int y = 0; y < height; y += size)
+        for (int x = 0; x < width; x += size)
+            tiles.push_back(
+                tile{x, y, std::min(x + size, width), std::min(y + size, height)});
+    return tiles;
+}
+
+// Reports a feature set without a kernel, see dispatch_features.
+static cudaError_t missing_kernel(unsigned int features) {
+    std::cerr << "No render kernel for feature set " << features << std::endl;
+    return cudaErrorInvalidValue;
+}
+
+cudaError_t launch_render_tile(cu_hittable** d_world, cu_camera* d_cam,
+                               render_target target, tile region,
+                               int num_samples, unsigned int target_samples,
+                               unsigned int features, cudaStream_t stream) {
+    dim3 threads_per_block(16, 16);
+    dim3 number_of_blocks((region.width() + 15) / 16,
+                          (region.height() + 15) / 16);
+
+    if (!dispatch_features(features, [&](auto f) {
+            render_pass<decltype(f)::value>
+                <<<number_of_blocks, threads_per_block, 0, stream>>>(
+                    d_world, d_cam, target, region, num_samples,
+                    target_samples);
+        }))
+        return missing_kernel(features);
+    return cudaSuccess;
+}
+
+cudaError_t launch_render_pass(cu_hittable** d_world, cu_camera* d_cam,
+                               render_target target, int num_samples,
+                               unsigned int target_samples,
+                               unsigned int features) {
+    cudaError_t err =
+        launch_render_tile(d_world, d_cam, target, target.window, num_samples,
+                           target_samples, features, 0);
+    if (err != cudaSuccess) return err;
+
+    return cudaDeviceSynchronize();
+}
+
+unsigned int Allocator::render_features(const cu_camera& cam, bool aov,
+                                        bool stats) const {
+    unsigned int kinds = material_kinds & all_material_kinds;
+    if (kinds == 0) kinds = all_material_kinds;
+    unsigned int features = kinds << feature_material_shift;
+    if (cam.ao_distance > 0) features = feature_ao;
+    if (cam.defocus_angle > 0) features |= feature_defocus;
+    if (aov) features |= feature_aov;
+    if (stats) features |= feature_stats;
+    return features;
+}
+
+// Mirrors an optional host buffer (empty: not in use) in managed memory.
+template <class T>
+static cudaError_t upload_optional(T*& device,
+                                   const render_buffer::storage<T>& host) {
+    device = nullptr;
+    if (host.empty()) return cudaSuccess;
+    cudaError_t err = cudaMallocManaged(&device, host.size() * sizeof(T));
+    if (err == cudaSuccess) std::copy(host.begin(), host.end(), device);
+    return err;
+}
+
+template <class T>
+static void download_optional(const T* device, render_buffer::storage<T>& host) {
+    if (device != nullptr) std::copy(device, device + host.size(), host.begin());
+}
+
+// Frees the buffers of `target` that were allocated (the fault flags belong
+// to the pager) and the camera.
+static void release_target(cu_camera* d_cam, render_target& target) {
+    cudaFree(d_cam);
+    cudaFree(target.accum);
+    cudaFree(target.samples);
+    cudaFree(target.lum_sq);
+    cudaFree(target.material_masks);
+    cudaFree(target.aov_normal);
+    cudaFree(target.aov_albedo);
+    cudaFree(target.ray_count);
+}
+
+bool Allocator::render(cu_camera cam, render_buffer& buffer,
+                       const render_options& opts) {
+    using clock = std::chrono::steady_clock;
+
+    cu_camera* d_cam;
+    cudaError_t err = cudaMallocManaged(&d_cam, sizeof(cu_camera));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate camera on the GPU" << std::endl;
+        return false;
+    }
+    *d_cam = cam;
+
+    render_target target;
+    target.width = buffer.width;
+    target.height = buffer.height;
+    target.seed = buffer.seed;
+    target.window = tile{0, 0, buffer.width, buffer.height};
+    target.accum = nullptr;
+    target.samples = nullptr;
+    target.lum_sq = nullptr;
+    target.faults = nullptr;
+    target.aov_normal = nullptr;
+    target.aov_albedo = nullptr;
+    target.material_masks = nullptr;
+    target.ray_count = nullptr;
+
+    err = cudaMallocManaged(&target.accum, buffer.size() * sizeof(color3));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.samples,
+                                buffer.size() * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.lum_sq, buffer.size() * sizeof(double));
+    if (err == cudaSuccess)
+        err = upload_optional(target.material_masks, buffer.material_masks);
+    if (err == cudaSuccess)
+        err = upload_optional(target.aov_normal, buffer.aov_normal);
+    if (err == cudaSuccess)
+        err = upload_optional(target.aov_albedo, buffer.aov_albedo);
+    if (err == cudaSuccess && opts.stats)
+        err = cudaMallocManaged(&target.ray_count, sizeof(unsigned long long));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate render buffer on the GPU" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        release_target(d_cam, target);
+        return false;
+    }
+
+    // A resumed buffer already holds samples; continue on top of them.
+    std::copy(buffer.accum.begin(), buffer.accum.end(), target.accum);
+    std::copy(buffer.samples.begin(), buffer.samples.end(), target.samples);
+    std::copy(buffer.lum_sq.begin(), buffer.lum_sq.end(), target.lum_sq);
+    if (target.ray_count != nullptr) *target.ray_count = 0;
+
+    bool aov = target.material_masks != nullptr ||
+               target.aov_normal != nullptr || target.aov_albedo != nullptr;
+    unsigned int features = render_features(cam, aov, opts.stats);
+
+    auto copy_back = [&]() {
+        std::copy(target.accum, target.accum + buffer.size(),
+                  buffer.accum.begin());
+        std::copy(target.samples, target.samples + buffer.size(),
+                  buffer.samples.begin());
+        std::copy(target.lum_sq, target.lum_sq + buffer.size(),
+                  buffer.lum_sq.begin());
+        download_optional(target.material_masks, buffer.material_masks);
+        download_optional(target.aov_normal, buffer.aov_normal);
+        download_optional(target.aov_albedo, buffer.aov_albedo);
+    };
+
+    unsigned int goal = opts.samples_per_pixel;
+    unsigned int done = buffer.min_samples();
+    auto start = clock::now();
+    auto last_checkpoint = start;
+    bool ok = true;
+
+    if (pager != nullptr) {
+        size_t threads = size_t((buffer.width + 15) / 16) *
+                         ((buffer.height + 15) / 16) * 256;
+        target.faults = pager->faults(threads);
+    }
+
+    // Seconds per sample per pixel, measured on the passes so far. With a
+    // time budget, passes are sized so that the last one still finishes
+    // before the deadline; every pass covers the whole image, so stopping
+    // between passes always leaves it uniformly sampled.
+    double sample_time = 0;
+    double error = inf;
+
+    while (done < goal) {
+        int pass = std::min<unsigned int>(opts.pass_samples, goal - done);
+
+        if (opts.time_budget > 0) {
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            double remaining = opts.time_budget - elapsed.count();
+            // The first pass only takes a single sample to calibrate; later
+            // ones keep a 10% margin for timing jitter.
+            // Clamped before converting: tiny sample times would overflow.
+            int affordable =
+                sample_time > 0
+                    ? int(std::min(0.9 * remaining / sample_time,
+                                   double(opts.pass_samples)))
+                : remaining > 0 ? 1
+                                : 0;
+            pass = std::min(pass, affordable);
+            if (pass < 1) break;
+        }
+
+        TRACE_SCOPE_ARG("render pass", "samples", (long long)pass);
+        auto pass_start = clock::now();
+        unsigned int pass_goal = std::min(goal, done + pass);
+        err = launch_render_pass(world, d_cam, target, pass, pass_goal,
+                                 features);
+
+        // Out-of-core scenes: rerun the pass for the samples that faulted
+        // until all bricks they need were paged in.
+        int relaunches = 0;
+        while (err == cudaSuccess && pager != nullptr && pager->service() > 0) {
+            if (++relaunches > 10000) {
+                std::cerr << "Paged scene cache is too small for a single "
+                             "pass"
+                          << std::endl;
+                ok = false;
+                break;
+            }
+            err = launch_render_pass(world, d_cam, target, pass, pass_goal,
+                                 features);
+        }
+        if (!ok) break;
+        if (pager != nullptr) pager->prefetch();
+        // Texture lookups that missed used a coarser level; upload what
+        // they asked for before the next pass.
+        if (textures != nullptr) textures->service();
+
+        if (err != cudaSuccess) {
+            std::cerr << "CUDA error: " << cudaGetErrorString(err)
+                      << std::endl;
+            ok = false;
+            break;
+        }
+        std::chrono::duration<double> pass_time = clock::now() - pass_start;
+
+        // Weigh recent passes more, the GPU clocks up over the first ones.
+        double measured = pass_time.count() / pass;
+        sample_time = sample_time > 0 ? 0.5 * (sample_time + measured)
+                                      : measured;
+
+        done += pass;
+        // The first pass filled the irradiance cache; later ones use it.
+        if (cam.irradiance_cache != nullptr) cam.irradiance_cache->frozen = 1;
+        // Deadlines without --spp have no sample cap (INT_MAX) to show.
+        std::clog << "\rSamples: " << done;
+        if (goal < (unsigned int)INT_MAX) std::clog << " / " << goal;
+        std::clog << ' ' << std::flush;
+
+        if (opts.target_error > 0) {
+            error = estimate_error(target.accum, target.lum_sq,
+                                   target.samples, buffer.size());
+            if (error <= opts.target_error) break;
+        }
+
+        std::chrono::duration<double> since = clock::now() - last_checkpoint;
+        if (!opts.checkpoint_path.empty() && done < goal &&
+            since.count() >= opts.checkpoint_interval) {
+            copy_back();
+            save_checkpoint(opts.checkpoint_path, buffer);
+            last_checkpoint = clock::now();
+        }
+    }
+    std::clog << "\rDone.                 \n";
+
+    copy_back();
+
+    std::chrono::duration<double> total = clock::now() - start;
+    if (opts.target_error <= 0) error = buffer.estimated_error();
+    std::clog << "Rendered " << done << " samples per pixel in "
+              << total.count() << "s, estimated relative error " << error
+              << std::endl;
+    if (target.ray_count != nullptr)
+        std::clog << "Traced " << *target.ray_count << " rays, "
+                  << *target.ray_count / total.count() / 1e6 << " Mrays/s"
+                  << std::endl;
+
+    if (pager != nullptr) {
+        paging_stats ps = pager->stats();
+        std::clog << "Paging: " << ps.resident_bricks << " / " << ps.bricks
+                  << " bricks resident (cache " << ps.cache_bricks << "), "
+                  << ps.touched_bricks << " recently used, " << ps.loads
+                  << " loads, " << ps.evictions << " evictions, "
+                  << ps.relaunches << " relaunches, "
+                  << ps.host_resident_bytes / (1024 * 1024)
+                  << " MiB of the scene file in host memory" << std::endl;
+    }
+
+    if (cam.irradiance_cache != nullptr) {
+        const cu_irradiance_cache& cache = *cam.irradiance_cache;
+        size_t used = 0, filled = 0;
+        for (unsigned int i = 0; i < cache.capacity; i++) {
+            used += cache.cells[i].key != 0;
+            filled += cache.cells[i].count >= cache.min_samples;
+        }
+        std::clog << "Irradiance cache (biased): " << filled << " of " << used
+                  << " cells usable, " << cache.capacity << " slots"
+                  << std::endl;
+    }
+
+    if (textures != nullptr) {
+        texture_cache_stats ts = textures->stats();
+        std::clog << "Textures: " << ts.resident_tiles << " / " << ts.tiles
+                  << " tiles resident (cache " << ts.cache_tiles << "), "
+                  << ts.loads << " loads, " << ts.evictions << " evictions"
+                  << std::endl;
+    }
+
+    if (ok && !opts.checkpoint_path.empty())
+        save_checkpoint(opts.checkpoint_path, buffer);
+
+    release_target(d_cam, target);
+    return ok;
+}
+
+bool Allocator::render_depth(const cu_camera& cam, std::vector<float>& depth) {
+    size_t pixels = size_t(cam.image_width) * cam.image_height;
+    cu_camera* d_cam;
+    float* d_depth;
+    cudaError_t err = cudaMallocManaged(&d_cam, sizeof(cu_camera));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_depth, pixels * sizeof(float));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate depth buffer on the GPU" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return false;
+    }
+    *d_cam = cam;
+
+    // Paged scenes give up on rays through bricks that are not resident;
+    // trace again until they were all paged in.
+    dim3 threads_per_block(16, 16);
+    dim3 number_of_blocks((cam.image_width + 15) / 16,
+                          (cam.image_height + 15) / 16);
+    if (pager != nullptr)
+        pager->faults(size_t(number_of_blocks.x) * number_of_blocks.y * 256);
+    int relaunches = 0;
+    do {
+        first_hit_depth<<<number_of_blocks, threads_per_block>>>(world, d_cam,
+                                                                 d_depth);
+        err = cudaDeviceSynchronize();
+    } while (err == cudaSuccess && pager != nullptr && pager->service() > 0 &&
+             ++relaunches < 100);
+
+    bool ok = err == cudaSuccess;
+    if (ok)
+        depth.assign(d_depth, d_depth + pixels);
+    else
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+
+    cudaFree(d_cam);
+    cudaFree(d_depth);
+    return ok;
+}
+
+/* Renders the image pixels `pixels` of `buffer` from scratch in place, pixel
+ * pixels[k] up to goals[k] samples, leaving everything else alone. Device
+ * buffers only cover the rectangle around the pixels, so the cost follows
+ * the size of the region rather than of the image.
+ */
+static bool render_pixels(Allocator& scene, const cu_camera& cam,
+                          render_buffer& buffer,
+                          const std::vector<unsigned int>& pixels,
+                          const std::vector<unsigned int>& goals,
+                          int pass_samples) {
+    size_t count = pixels.size();
+    tile window{buffer.width, buffer.height, 0, 0};
+    unsigned int goal = 0;
+    for (size_t k = 0; k < count; k++) {
+        int i = pixels[k] % buffer.width, j = pixels[k] / buffer.width;
+        window.x0 = std::min(window.x0, i);
+        window.y0 = std::min(window.y0, j);
+        window.x1 = std::max(window.x1, i + 1);
+        window.y1 = std::max(window.y1, j + 1);
+        goal = std::max(goal, goals[k]);
+    }
+    size_t area = size_t(window.width()) * window.height();
+    bool masks = !buffer.material_masks.empty();
+
+    cu_camera* d_cam = nullptr;
+    unsigned int* d_pixels = nullptr;
+    unsigned int* d_goals = nullptr;
+    render_target target;
+    target.width = buffer.width;
+    target.height = buffer.height;
+    target.seed = buffer.seed;
+    target.window = window;
+    target.accum = nullptr;
+    target.samples = nullptr;
+    target.lum_sq = nullptr;
+    target.faults = nullptr;
+    target.aov_normal = nullptr;
+    target.aov_albedo = nullptr;
+    target.material_masks = nullptr;
+    target.ray_count = nullptr;
+
+    auto release = [&]() {
+        cudaFree(d_pixels);
+        cudaFree(d_goals);
+        release_target(d_cam, target);
+    };
+
+    cudaError_t err = cudaMallocManaged(&d_cam, sizeof(cu_camera));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_pixels, count * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&d_goals, count * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.accum, area * sizeof(color3));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.samples, area * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.lum_sq, area * sizeof(double));
+    if (err == cudaSuccess && masks)
+        err = cudaMallocManaged(&target.material_masks,
+                                area * sizeof(unsigned long long));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate region buffers on the GPU"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        release();
+        return false;
+    }
+
+    *d_cam = cam;
+    for (size_t k = 0; k < count; k++) {
+        int i = pixels[k] % buffer.width, j = pixels[k] / buffer.width;
+        size_t w = target.index(i, j);
+        d_pixels[k] = w;
+        d_goals[k] = goals[k];
+        target.accum[w] = color3(0, 0, 0);
+        target.samples[w] = 0;
+        target.lum_sq[w] = 0;
+        if (masks) target.material_masks[w] = 0;
+    }
+
+    int blocks = (count + 255) / 256;
+    if (scene.pager != nullptr)
+        target.faults = scene.pager->faults(size_t(blocks) * 256);
+    unsigned int features = scene.render_features(cam, masks, false);
+    auto launch = [&]() {
+        if (!dispatch_features(features, [&](auto f) {
+                render_pixel_list<decltype(f)::value><<<blocks, 256>>>(
+                    scene.world, d_cam, target, d_pixels, d_goals, count,
+                    pass_samples);
+            }))
+            return missing_kernel(features);
+        return cudaDeviceSynchronize();
+    };
+
+    bool ok = true;
+    for (unsigned int done = 0; ok && done < goal; done += pass_samples) {
+        err = launch();
+        // Same as in render(): faulted samples are redone once paged in.
+        int relaunches = 0;
+        while (err == cudaSuccess && scene.pager != nullptr &&
+               scene.pager->service() > 0) {
+            if (++relaunches > 10000) {
+                std::cerr << "Paged scene cache is too small for a single "
+                             "pass"
+                          << std::endl;
+                ok = false;
+                break;
+            }
+            err = launch();
+        }
+        if (scene.pager != nullptr) scene.pager->prefetch();
+        if (scene.textures != nullptr) scene.textures->service();
+        if (err != cudaSuccess) {
+            std::cerr << "CUDA error: " << cudaGetErrorString(err)
+                      << std::endl;
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        for (unsigned int p : pixels) {
+            size_t w = target.index(p % buffer.width, p / buffer.width);
+            buffer.accum[p] = target.accum[w];
+            buffer.samples[p] = target.samples[w];
+            buffer.lum_sq[p] = target.lum_sq[w];
+            if (masks) buffer.material_masks[p] = target.material_masks[w];
+        }
+    }
+
+    release();
+    return ok;
+}
+
+bool Allocator::relight(cu_camera cam, render_buffer& buffer,
+                        const std::vector<cu_material**>& edited,
+                        const render_options& opts) {
+    TRACE_SCOPE("relight");
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    if (buffer.material_masks.size() != buffer.size()) {
+        std::cerr << "Relighting needs the material masks of the render"
+                  << std::endl;
+        return false;
+    }
+    if (pager != nullptr) {
+        std::cerr << "Relighting is not supported for paged scenes"
+                  << std::endl;
+        return false;
+    }
+
+    unsigned long long edited_mask = 0;
+    for (cu_material** mat : edited) edited_mask |= material_mask(mat);
+
+    // Pixels go back to the sample counts they had.
+    std::vector<unsigned int> pixels, goals;
+    for (size_t p = 0; p < buffer.size(); p++)
+        if (buffer.material_masks[p] & edited_mask) {
+            pixels.push_back(p);
+            goals.push_back(buffer.samples[p]);
+        }
+
+    if (pixels.empty()) {
+        std::clog << "Relight: no pixel sees the edited materials" << std::endl;
+        return true;
+    }
+
+    bool ok = render_pixels(*this, cam, buffer, pixels, goals,
+                            opts.pass_samples);
+
+    std::chrono::duration<double> total = clock::now() - start;
+    std::clog << "Relit " << pixels.size() << " of " << buffer.size()
+              << " pixels in " << total.count() << "s" << std::endl;
+    return ok;
+}
+
+bool Allocator::render_region(cu_camera cam, render_buffer& buffer,
+                              const std::vector<unsigned int>& pixels,
+                              const render_options& opts) {
+    TRACE_SCOPE_ARG("render region", "pixels", (long long)pixels.size());
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    if (pixels.empty()) return true;
+
+    std::vector<unsigned int> goals(pixels.size(), opts.samples_per_pixel);
+    bool ok = render_pixels(*this, cam, buffer, pixels, goals,
+                            opts.pass_samples);
+
+    std::chrono::duration<double> total = clock::now() - start;
+    std::clog << "Rendered " << pixels.size() << " of " << buffer.size()
+              << " pixels to " << opts.samples_per_pixel
+              << " samples in " << total.count() << "s" << std::endl;
+    return ok;
+}
@@ -0,0 +1,204 @@
+#include "batch_render.hpp"
+
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+static bool read_point(std::istream& in, point3& p) {
+    double x, y, z;
+    if (!(in >> x >> y >> z)) return false;
+    p = point3(x, y, z);
+    return true;
+}
+
+// Reads the optional trailing numbers of a line into `values`, in order.
+// Fails on anything else.
+static bool read_optional(std::istream& in, std::vector<double*> values) {
+    for (double* value : values) {
+        std::string token;
+        if (!(in >> token)) return true;
+        std::istringstream number(token);
+        if (!(number >> *value) || !number.eof()) return false;
+    }
+    std::string extra;
+    return !(in >> extra);
+}
+
+static render_view make_view(const std::string& output, const cu_camera& base,
+                             const point3& from, const point3& at, double fov,
+                             double width) {
+    render_view view{output, base};
+    view.camera.lookfrom = from;
+    view.camera.lookat = at;
+    view.camera.fov = fov;
+    view.camera.image_width = int(width);
+    view.camera.initialize();
+    return view;
+}
+
+bool load_views(const std::string& path, const cu_camera& base,
+                std::vector<render_view>& views) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open views file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        std::istringstream in(line);
+        std::string directive, name;
+        if (!(in >> directive) || directive[0] == '#') continue;
+
+        double fov = base.fov;
+        double width = base.image_width;
+        point3 from, at;
+        bool ok = bool(in >> name);
+
+        if (ok && directive == "view") {
+            ok = read_point(in, from) && read_point(in, at) &&
+                 read_optional(in, {&fov, &width});
+            if (ok) views.push_back(make_view(name, base, from, at, fov, width));
+        } else if (ok && directive == "stereo") {
+            double eye_distance;
+            ok = read_point(in, from) && read_point(in, at) &&
+                 bool(in >> eye_distance) && read_optional(in, {&fov, &width});
+            if (ok) {
+                // Parallel axes: both eyes move along the camera's right
+                // vector, the point they look at moves with them.
+                vec3 right = unit_vector(cross(base.vup, from - at));
+                vec3 offset = 0.5 * eye_distance * right;
+                views.push_back(make_view(name + ".left.ppm", base,
+                                          from - offset, at - offset, fov,
+                                          width));
+                views.push_back(make_view(name + ".right.ppm", base,
+                                          from + offset, at + offset, fov,
+                                          width));
+            }
+        } else if (ok && directive == "cubemap") {
+            ok = read_point(in, from) && read_optional(in, {&width});
+            if (ok) {
+                struct face {
+                    const char* suffix;
+                    vec3 direction, up;
+                };
+                const face faces[6] = {
+                    {".px.ppm", vec3(1, 0, 0), vec3(0, 1, 0)},
+                    {".nx.ppm", vec3(-1, 0, 0), vec3(0, 1, 0)},
+                    {".py.ppm", vec3(0, 1, 0), vec3(0, 0, -1)},
+                    {".ny.ppm", vec3(0, -1, 0), vec3(0, 0, 1)},
+                    {".pz.ppm", vec3(0, 0, 1), vec3(0, 1, 0)},
+                    {".nz.ppm", vec3(0, 0, -1), vec3(0, 1, 0)},
+                };
+                cu_camera square = base;
+                square.aspect_ratio = 1;
+                square.defocus_angle = 0;
+                for (const face& f : faces) {
+                    square.vup = f.up;
+                    views.push_back(make_view(name + f.suffix, square, from,
+                                              from + f.direction, 90, width));
+                }
+            }
+        } else {
+            ok = false;
+        }
+
+        if (!ok || width < 1 || fov <= 0 || fov >= 180) {
+            std::cerr << "Invalid line " << number << " in views file " << path
+                      << ": " << line << std::endl;
+            return false;
+        }
+    }
+
+    if (views.empty()) {
+        std::cerr << "No views in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool render_batch(
+    std::shared_ptr<const Allocator> scene,
+    const std::vector<render_view>& views, const render_options& opts,
+    const std::function<bool(size_t index, const job_result& result)>&
+        on_view) {
+    TRACE_SCOPE_ARG("batch render", "views", (long long)views.size());
+    if (scene->pager != nullptr) {
+        std::cerr << "Batch renders do not support paged scenes" << std::endl;
+        return false;
+    }
+
+    // Enough queued tiles to keep every worker busy while a view finishes,
+    // without holding the buffers of the whole batch at once.
+    job_settings defaults;
+    const size_t max_tiles = 4 * thread_pool::global().size();
+    auto view_tiles = [&](size_t i) {
+        const cu_camera& cam = views[i].camera;
+        size_t size = defaults.tile_size;
+        return ((cam.image_width + size - 1) / size) *
+               ((cam.image_height + size - 1) / size);
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<size_t> finished;
+
+    std::vector<std::shared_ptr<render_job>> jobs(views.size());
+    size_t next = 0, in_flight = 0, queued_tiles = 0;
+    bool ok = true;
+
+    auto submit_more = [&]() {
+        while (next < views.size() && ok &&
+               (in_flight == 0 || queued_tiles < max_tiles)) {
+            size_t i = next++;
+            job_settings settings;
+            settings.priority = -int(i);
+            settings.on_finished = [&, i] {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(i);
+                wake.notify_one();
+            };
+            in_flight++;
+            queued_tiles += view_tiles(i);
+            jobs[i] = submit_render_job(scene, views[i].camera, opts, settings);
+        }
+    };
+
+    submit_more();
+    for (size_t done = 0; in_flight > 0; done++) {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return !finished.empty(); });
+            i = finished.front();
+            finished.erase(finished.begin());
+        }
+        in_flight--;
+        queued_tiles -= view_tiles(i);
+
+        const job_result& res = jobs[i]->wait();
+        if (!res.ok) {
+            std::cerr << "Rendering " << views[i].output << " failed"
+                      << std::endl;
+            ok = false;
+        } else if (!res.cancelled && !on_view(i, res)) {
+            ok = false;
+        }
+        jobs[i].reset();  // Frees the result
+
+        if (!ok)
+            for (auto& job : jobs)
+                if (job) job->cancel();
+        submit_more();
+        std::clog << "\rViews: " << done + 1 << " / " << views.size() << ' '
+                  << std::flush;
+    }
+    std::clog << "\rDone.                 \n";
+
+    return ok && next == views.size();
+}
@@ -0,0 +1,55 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+
+#include "trace.hpp"
+
+static void build_node(std::vector<bvh_node>& nodes, int index,
+                       const std::vector<aabb>& boxes, std::vector<int>& order,
+                       int start, int end, int leaf_size) {
+    aabb box;
+    aabb centroids;
+    for (int i = start; i < end; i++) {
+        box = aabb(box, boxes[order[i]]);
+        point3 c = boxes[order[i]].centroid();
+        centroids = aabb(centroids, aabb(c, c));
+    }
+
+    nodes[index].box = box;
+    nodes[index].axis = centroids.longest_axis();
+
+    if (end - start <= leaf_size) {
+        nodes[index].first = start;
+        nodes[index].count = end - start;
+        return;
+    }
+
+    int axis = nodes[index].axis;
+    int mid = start + (end - start) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid,
+                     order.begin() + end, [&](int a, int b) {
+                         return boxes[a].centroid()[axis] <
+                                boxes[b].centroid()[axis];
+                     });
+
+    int left = nodes.size();
+    nodes.push_back(bvh_node());
+    nodes.push_back(bvh_node());
+    nodes[index].first = left;
+    nodes[index].count = 0;
+
+    build_node(nodes, left, boxes, order, start, mid, leaf_size);
+    build_node(nodes, left + 1, boxes, order, mid, end, leaf_size);
+}
+
+std::vector<bvh_node> build_bvh(const std::vector<aabb>& boxes,
+                                std::vector<int>& order, int leaf_size) {
+    TRACE_SCOPE_ARG("bvh build", "primitives", (long long)boxes.size());
+    order.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++) order[i] = i;
+
+    std::vector<bvh_node> nodes(1);
+    nodes.reserve(2 * boxes.size() + 1);
+    build_node(nodes, 0, boxes, order, 0, boxes.size(), leaf_size);
+    return nodes;
+}
@@ -0,0 +1,125 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "trace.hpp"
+
+// Pixel sums are stored as 3 doubles whatever the layout of vec3 (see
+// simd.hpp), converted a chunk at a time.
+constexpr size_t accum_chunk = 1 << 14;
+
+static void write_accum(std::ostream& out, const render_buffer& buffer) {
+    std::vector<double> chunk(3 * accum_chunk);
+    for (size_t i = 0; i < buffer.size(); i += accum_chunk) {
+        size_t n = std::min(accum_chunk, buffer.size() - i);
+        for (size_t k = 0; k < n; k++)
+            for (int c = 0; c < 3; c++) chunk[3 * k + c] = buffer.accum[i + k][c];
+        out.write(reinterpret_cast<const char*>(chunk.data()),
+                  3 * n * sizeof(double));
+    }
+}
+
+static void read_accum(std::istream& in, render_buffer& buffer) {
+    std::vector<double> chunk(3 * accum_chunk);
+    for (size_t i = 0; i < buffer.size() && in; i += accum_chunk) {
+        size_t n = std::min(accum_chunk, buffer.size() - i);
+        in.read(reinterpret_cast<char*>(chunk.data()), 3 * n * sizeof(double));
+        for (size_t k = 0; k < n; k++)
+            buffer.accum[i + k] =
+                color3(chunk[3 * k], chunk[3 * k + 1], chunk[3 * k + 2]);
+    }
+}
+
+bool save_checkpoint(const std::string& path, const render_buffer& buffer) {
+    TRACE_SCOPE("checkpoint write");
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Could not open checkpoint file " << tmp_path
+                  << std::endl;
+        return false;
+    }
+
+    checkpoint_header header;
+    header.width = buffer.width;
+    header.height = buffer.height;
+    header.seed = buffer.seed;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_accum(out, buffer);
+    out.write(reinterpret_cast<const char*>(buffer.samples.data()),
+              buffer.size() * sizeof(unsigned int));
+    out.write(reinterpret_cast<const char*>(buffer.lum_sq.data()),
+              buffer.size() * sizeof(double));
+    out.close();
+
+    if (!out) {
+        std::cerr << "Could not write checkpoint file " << tmp_path
+                  << std::endl;
+        return false;
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not move checkpoint into place: " << path
+                  << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool load_checkpoint(const std::string& path, render_buffer& buffer) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open checkpoint file " << path << std::endl;
+        return false;
+    }
+
+    checkpoint_header expected, header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, expected.magic, 4) != 0 ||
+        header.version < 1 || header.version > expected.version) {
+        std::cerr << "Not a checkpoint file (or unsupported version): " << path
+                  << std::endl;
+        return false;
+    }
+
+    // Check the resolution against the file size before allocating for it,
+    // so a corrupt header fails cleanly instead of asking for terabytes.
+    in.seekg(0, std::ios::end);
+    unsigned long long data_bytes =
+        (unsigned long long)in.tellg() - sizeof(header);
+    in.seekg(sizeof(header));
+    unsigned long long pixel_bytes = 3 * sizeof(double) + sizeof(unsigned int);
+    if (header.version >= 2) pixel_bytes += sizeof(double);
+    unsigned long long pixels =
+        (unsigned long long)header.width * header.height;
+    if (header.width == 0 || header.height == 0 || header.width > 1u << 20 ||
+        header.height > 1u << 20 || pixels * pixel_bytes != data_bytes) {
+        std::cerr << "Checkpoint size does not match its " << header.width
+                  << "x" << header.height << " header: " << path << std::endl;
+        return false;
+    }
+
+    render_buffer loaded(header.width, header.height, header.seed);
+    read_accum(in, loaded);
+    in.read(reinterpret_cast<char*>(loaded.samples.data()),
+            loaded.size() * sizeof(unsigned int));
+    // Version 1 files carry no second moments, so the error estimate reads
+    // low until new samples outweigh the loaded ones.
+    if (header.version >= 2)
+        in.read(reinterpret_cast<char*>(loaded.lum_sq.data()),
+                loaded.size() * sizeof(double));
+    if (!in) {
+        std::cerr << "Checkpoint file is truncated: " << path << std::endl;
+        return false;
+    }
+
+    buffer = std::move(loaded);
+    return true;
+}
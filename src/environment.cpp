@@ -0,0 +1,188 @@
+#include "environment.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "render_buffer.hpp"
+#include "utils.hpp"
+
+static bool load_pfm(std::istream& in, const std::string& path,
+                     hdr_image& image) {
+    std::string magic;
+    int w, h;
+    double scale;
+    if (!(in >> magic >> w >> h >> scale) || magic != "PF" || w < 1 ||
+        h < 1 || scale == 0) {
+        std::cerr << "Unsupported PFM image (needs color PF): " << path
+                  << std::endl;
+        return false;
+    }
+    in.get();  // Single whitespace before the data
+
+    // Rows are stored bottom to top, little endian when scale < 0.
+    image.width = w;
+    image.height = h;
+    image.rgb.resize(size_t(w) * h * 3);
+    const bool swap = scale > 0;
+    std::vector<unsigned char> row(size_t(w) * 3 * 4);
+    for (int y = h - 1; y >= 0; y--) {
+        if (!in.read(reinterpret_cast<char*>(row.data()), row.size())) {
+            std::cerr << "PFM image is truncated: " << path << std::endl;
+            return false;
+        }
+        if (swap)
+            for (size_t i = 0; i < row.size(); i += 4) {
+                std::swap(row[i], row[i + 3]);
+                std::swap(row[i + 1], row[i + 2]);
+            }
+        std::memcpy(&image.rgb[size_t(y) * w * 3], row.data(), row.size());
+    }
+    return true;
+}
+
+static void rgbe_to_float(const unsigned char* rgbe, float* rgb) {
+    if (rgbe[3] == 0) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }
+    float f = std::ldexp(1.0f, int(rgbe[3]) - (128 + 8));
+    for (int c = 0; c < 3; c++) rgb[c] = (rgbe[c] + 0.5f) * f;
+}
+
+// One scanline of RGBE pixels, run length encoded per channel or flat.
+static bool read_rgbe_scanline(std::istream& in, int width,
+                               std::vector<unsigned char>& rgbe) {
+    unsigned char head[4];
+    if (!in.read(reinterpret_cast<char*>(head), 4)) return false;
+
+    bool rle = width >= 8 && width < 0x8000 && head[0] == 2 && head[1] == 2 &&
+               !(head[2] & 0x80);
+    if (!rle) {
+        std::memcpy(rgbe.data(), head, 4);
+        return bool(in.read(reinterpret_cast<char*>(rgbe.data() + 4),
+                            size_t(width - 1) * 4));
+    }
+    if (((head[2] << 8) | head[3]) != width) return false;
+
+    for (int c = 0; c < 4; c++) {
+        for (int x = 0; x < width;) {
+            int count = in.get();
+            if (count == EOF) return false;
+            if (count > 128) {
+                count -= 128;
+                int value = in.get();
+                if (value == EOF || x + count > width) return false;
+                for (int k = 0; k < count; k++) rgbe[(x++) * 4 + c] = value;
+            } else {
+                if (count == 0 || x + count > width) return false;
+                for (int k = 0; k < count; k++) {
+                    int value = in.get();
+                    if (value == EOF) return false;
+                    rgbe[(x++) * 4 + c] = value;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool load_radiance(std::istream& in, const std::string& path,
+                          hdr_image& image) {
+    std::string line;
+    while (std::getline(in, line) && !line.empty()) {
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+            std::cerr << "Unsupported Radiance format " << line << ": " << path
+                      << std::endl;
+            return false;
+        }
+    }
+
+    // Only the standard orientation, rows from the top.
+    char y_axis[3], x_axis[3];
+    int w, h;
+    if (!std::getline(in, line) ||
+        std::sscanf(line.c_str(), "%2s %d %2s %d", y_axis, &h, x_axis, &w) !=
+            4 ||
+        std::strcmp(y_axis, "-Y") != 0 || std::strcmp(x_axis, "+X") != 0 ||
+        w < 1 || h < 1) {
+        std::cerr << "Unsupported Radiance image resolution \"" << line
+                  << "\": " << path << std::endl;
+        return false;
+    }
+
+    image.width = w;
+    image.height = h;
+    image.rgb.resize(size_t(w) * h * 3);
+    std::vector<unsigned char> rgbe(size_t(w) * 4);
+    for (int y = 0; y < h; y++) {
+        if (!read_rgbe_scanline(in, w, rgbe)) {
+            std::cerr << "Radiance image is truncated or corrupt: " << path
+                      << std::endl;
+            return false;
+        }
+        for (int x = 0; x < w; x++)
+            rgbe_to_float(&rgbe[size_t(x) * 4],
+                          &image.rgb[(size_t(y) * w + x) * 3]);
+    }
+    return true;
+}
+
+bool load_hdr_image(const std::string& path, hdr_image& image) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open image " << path << std::endl;
+        return false;
+    }
+
+    char magic[2] = {};
+    in.read(magic, 2);
+    in.seekg(0);
+    if (magic[0] == 'P' && magic[1] == 'F') return load_pfm(in, path, image);
+    if (magic[0] == '#' && magic[1] == '?')
+        return load_radiance(in, path, image);
+
+    std::cerr << "Not a PFM or Radiance HDR image: " << path << std::endl;
+    return false;
+}
+
+// Running sums of `weights` into `cdf` (one entry longer), normalised to end
+// at 1; all zero weights give a uniform cdf.
+static void build_cdf(const double* weights, int n, float* cdf) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += weights[i];
+    double running = 0;
+    cdf[0] = 0;
+    for (int i = 0; i < n; i++) {
+        running += weights[i];
+        cdf[i + 1] = sum > 0 ? float(running / sum) : float(i + 1) / n;
+    }
+    cdf[n] = 1;
+}
+
+environment_map build_environment(hdr_image image) {
+    environment_map env;
+    const int w = image.width, h = image.height;
+    env.row_cdf.resize(h + 1);
+    env.column_cdf.resize(size_t(h) * (w + 1));
+
+    std::vector<double> weights(w);
+    std::vector<double> row_weights(h);
+    for (int y = 0; y < h; y++) {
+        double sin_theta = std::sin(pi * (y + 0.5) / h);
+        double sum = 0;
+        for (int x = 0; x < w; x++) {
+            const float* p = &image.rgb[(size_t(y) * w + x) * 3];
+            weights[x] = std::max(0.0, luminance(color3(p[0], p[1], p[2])));
+            sum += weights[x];
+        }
+        build_cdf(weights.data(), w, &env.column_cdf[size_t(y) * (w + 1)]);
+        row_weights[y] = sum * sin_theta;
+    }
+    build_cdf(row_weights.data(), h, env.row_cdf.data());
+
+    env.image = std::move(image);
+    return env;
+}
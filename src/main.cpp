@@ -1,8 +1,26 @@
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
 
+#include "batch_render.hpp"
+#include "checkpoint.hpp"
 #include "cuda/cu_allocate.hpp"
 #include "cuda/cu_camera.hpp"
 #include "device_helper.hpp"
+#include "mesh.hpp"
+#include "numa.hpp"
+#include "options.hpp"
+#include "paged_scene.hpp"
+#include "render_buffer.hpp"
+#include "stream_render.hpp"
+#include "temporal.hpp"
+#include "texture.hpp"
+#include "trace.hpp"
+#include "volume.hpp"
 
 int main1() {
     Allocator a;
@@ -52,10 +70,85 @@ int main1() {
 
 }
 
-int main() {
-    Allocator world;
+// Loads the OBJ file at `path` and places it, scaled to a height of two
+// units, on the ground in front of the large spheres.
+static bool add_obj_mesh(Allocator& world, const std::string& path) {
+    triangle_mesh mesh;
+    if (!load_obj(path, mesh)) return false;
+    std::clog << "Loaded " << mesh.triangles.size() << " triangles from "
+              << path << std::endl;
+
+    // The mesh lives in its own Allocator so that only the instance ends up
+    // in the world.
+    static Allocator mesh_scene;
+    auto material = world.allocate_lambertian(color3(0.7, 0.7, 0.7));
+    auto object = mesh_scene.allocate_mesh(mesh, material);
+    if (object == nullptr) return false;
+
+    aabb box = mesh.bounds();
+    point3 base(0.5 * (box.x.min + box.x.max), box.y.min,
+                0.5 * (box.z.min + box.z.max));
+    double height = box.y.size() > 0 ? box.y.size() : 1.0;
+    transform placement = transform::translate(vec3(2, 0, 2.5)) *
+                          transform::scale(2.0 / height) *
+                          transform::translate(-base);
+    return world.allocate_instance(object, box, placement) != nullptr;
+}
+
+/* Adds the media of `opts`: fog in a sphere around the whole scene, camera
+ * included, and the gridvolume inside the sphere around its bounds. Their
+ * boundaries live in their own Allocator, only the media are in the world.
+ */
+static bool add_media(Allocator& world, const render_options& opts) {
+    if (opts.fog_density <= 0 && opts.volume_path.empty()) return true;
+    static Allocator boundaries;
+    auto boundary_material = boundaries.allocate_lambertian(color3(0, 0, 0));
+
+    if (opts.fog_density > 0) {
+        const double radius = 30;
+        auto sphere = boundaries.allocate_sphere(point3(0, 0, 0), radius,
+                                                 boundary_material);
+        auto phase = world.allocate_isotropic(color3(1, 1, 1));
+        aabb box(point3(-radius, -radius, -radius),
+                 point3(radius, radius, radius));
+        if (sphere == nullptr || phase == nullptr ||
+            world.allocate_medium(sphere, box, opts.fog_density, phase) ==
+                nullptr)
+            return false;
+    }
+
+    if (!opts.volume_path.empty()) {
+        density_grid grid;
+        if (!load_density_grid(opts.volume_path, grid)) return false;
+        std::clog << "Loaded a " << grid.nx << "x" << grid.ny << "x"
+                  << grid.nz << " density grid from " << opts.volume_path
+                  << std::endl;
+
+        point3 center = grid.bounds.centroid();
+        double radius = 0.5 * (grid.bounds.max() - grid.bounds.min()).length();
+        auto sphere =
+            boundaries.allocate_sphere(center, radius, boundary_material);
+        auto phase = world.allocate_isotropic(color3(0.9, 0.9, 0.9));
+        if (sphere == nullptr || phase == nullptr ||
+            world.allocate_medium(sphere, grid.bounds, grid,
+                                  opts.volume_density, phase) == nullptr)
+            return false;
+    }
+    return true;
+}
 
-    auto ground_material = world.allocate_lambertian(color3(0.5, 0.5, 0.5));
+static bool build_default_scene(Allocator& world, const render_options& opts) {
+    world.texture_cache_bytes = opts.texture_cache_mb << 20;
+
+    cu_material** ground_material;
+    if (opts.noise_scale > 0) {
+        auto marble =
+            world.allocate_noise_texture(opts.noise_scale, color3(1, 1, 1));
+        if (marble == nullptr) return false;
+        ground_material = world.allocate_lambertian(marble);
+    } else {
+        ground_material = world.allocate_lambertian(color3(0.5, 0.5, 0.5));
+    }
     world.allocate_sphere(point3(0,-1000,0), 1000, ground_material);
 
     for (int a = -11; a < 11; a++) {
@@ -89,19 +182,312 @@ int main() {
     auto material1 = world.allocate_dielectric(1.5);
     world.allocate_sphere(point3(0, 1, 0), 1.0, material1);
 
-    auto material2 = world.allocate_lambertian(color3(0.4, 0.2, 0.1));
+    cu_material** material2;
+    if (!opts.texture_path.empty()) {
+        auto image = world.allocate_image_texture(opts.texture_path);
+        if (image == nullptr) return false;
+        material2 = world.allocate_lambertian(image);
+    } else {
+        material2 = world.allocate_lambertian(color3(0.4, 0.2, 0.1));
+    }
     world.allocate_sphere(point3(-4, 1, 0), 1.0, material2);
 
     auto material3 = world.allocate_metal(color3(0.7, 0.6, 0.5), 0.0);
     world.allocate_sphere(point3(4, 1, 0), 1.0, material3);
 
-    world.allocate_list();
+    if (!opts.obj_path.empty() && !add_obj_mesh(world, opts.obj_path))
+        return false;
+    if (!add_media(world, opts)) return false;
+
+    return world.allocate_bvh() != nullptr;
+}
+
+// Writes `count` small random spheres scattered over a large area, as a test
+// scene for out-of-core rendering.
+static bool write_random_scene(const std::string& path, size_t count) {
+    std::vector<material_record> materials;
+    for (int i = 0; i < 64; i++) {
+        auto albedo = color3::random() * color3::random();
+        materials.push_back(material_record{
+            material_lambertian,
+            {float(albedo.x()), float(albedo.y()), float(albedo.z())},
+            0});
+    }
+    materials.push_back(material_record{material_metal, {0.7f, 0.6f, 0.5f}, 0.1f});
+    materials.push_back(material_record{material_dielectric, {1, 1, 1}, 1.5f});
+
+    double extent = std::sqrt(double(count)) * 0.5;
+    std::vector<sphere_input> spheres(count);
+    for (auto& s : spheres) {
+        s.center[0] = random_double(-extent, extent);
+        s.center[1] = random_double(0, 0.5);
+        s.center[2] = random_double(-extent, extent);
+        s.radius = random_double(0.05, 0.25);
+        s.material = rand() % materials.size();
+    }
+
+    return write_scene_file(path, spheres, materials);
+}
+
+static void write_ppm(std::ostream& out, const render_buffer& buffer) {
+    TRACE_SCOPE("tonemap and image write");
+    out << "P3\n" << buffer.width << ' ' << buffer.height << "\n255\n";
+    for (size_t i = 0; i < buffer.size(); i++)
+        write_color(out, buffer.resolve(i));
+    out.flush();
+}
+
+// Writes the average of a per-pixel sum AOV, mapped from [lo, hi] to the
+// full 8-bit range without gamma.
+template <class T>
+static bool write_aov(const std::string& path, const render_buffer& buffer,
+                      const render_buffer::storage<T>& sums, double lo,
+                      double hi) {
+    std::ofstream out(path);
+    out << "P3\n" << buffer.width << ' ' << buffer.height << "\n255\n";
+    for (size_t i = 0; i < buffer.size(); i++) {
+        vec3 v = buffer.samples[i] ? sums[i] / buffer.samples[i] : vec3(lo, lo, lo);
+        for (int c = 0; c < 3; c++) {
+            double x = std::fmin(std::fmax((v[c] - lo) / (hi - lo), 0.0), 1.0);
+            out << int(255.999 * x) << (c < 2 ? ' ' : '\n');
+        }
+    }
+    if (!out) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* Reads material edits from stdin, one per line:
+ *     <material> <r> <g> <b> <param>
+ * where <material> is the allocation index of the material and <param> its
+ * fuzz or refraction index. Only the pixels that see the material are
+ * re-rendered; the image is rewritten after every edit.
+ */
+static bool run_lookdev(Allocator& world, const cu_camera& cam,
+                        render_buffer& buffer, const render_options& opts) {
+    {
+        std::ofstream out(opts.lookdev_path);
+        write_ppm(out, buffer);
+    }
+    std::clog << "Material edits: <material> <r> <g> <b> <param>, "
+              << world.allocated_materials.size() << " materials" << std::endl;
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        size_t index;
+        double r, g, b, param;
+        if (!(in >> index >> r >> g >> b >> param) ||
+            index >= world.allocated_materials.size()) {
+            std::cerr << "Invalid edit: " << line << std::endl;
+            continue;
+        }
+
+        cu_material** mat = world.allocated_materials[index];
+        if (!world.edit_material(mat, color3(r, g, b), param)) return false;
+        if (!world.relight(cam, buffer, {mat}, opts)) return false;
+
+        std::ofstream out(opts.lookdev_path);
+        write_ppm(out, buffer);
+    }
+    return true;
+}
+
+/* Renders the views of `opts.sequence_path` in order as the frames of a
+ * camera move. Each frame starts from the previous one reprojected (see
+ * temporal.hpp) and is rendered up to `opts.samples_per_pixel`; history is
+ * capped so that every pixel still gets `opts.fresh_samples` new samples,
+ * while disoccluded pixels get all of theirs.
+ */
+static bool run_sequence(Allocator& world, const cu_camera& cam,
+                         const render_options& opts) {
+    std::vector<render_view> frames;
+    if (!load_views(opts.sequence_path, cam, frames)) return false;
+
+    unsigned int max_history = opts.samples_per_pixel - opts.fresh_samples;
+    frame_history history;
+    for (size_t f = 0; f < frames.size(); f++) {
+        TRACE_SCOPE_ARG("frame", "index", (long long)f);
+        const cu_camera& frame_cam = frames[f].camera;
+
+        std::vector<float> depth;
+        if (!world.render_depth(frame_cam, depth)) return false;
+
+        // New samples need random streams of their own in every frame.
+        render_buffer buffer(frame_cam.image_width, frame_cam.image_height,
+                             opts.seed + f);
+        if (!history.empty()) {
+            reprojection_stats stats =
+                reproject(history, frame_cam, depth, max_history, buffer);
+            std::clog << "Frame " << f << ": reused " << stats.reused
+                      << " pixels, " << stats.rejected << " disoccluded"
+                      << std::endl;
+        }
+        if (!world.render(frame_cam, buffer, opts)) return false;
+
+        std::ofstream out(frames[f].output);
+        write_ppm(out, buffer);
+        if (!out) {
+            std::cerr << "Could not write " << frames[f].output << std::endl;
+            return false;
+        }
+
+        history.camera = frame_cam;
+        history.buffer = std::move(buffer);
+        history.depth = std::move(depth);
+    }
+    return true;
+}
+
+// Selection of --region and --region-mask as row major pixel indices.
+static bool select_region(const render_options& opts, int width, int height,
+                          std::vector<unsigned int>& pixels) {
+    std::vector<unsigned char> selected(size_t(width) * height, 0);
+    const int* r = opts.region;
+    if (r[2] > r[0]) {
+        if (r[2] > width || r[3] > height) {
+            std::cerr << "--region lies outside the " << width << "x"
+                      << height << " image" << std::endl;
+            return false;
+        }
+        for (int j = r[1]; j < r[3]; j++)
+            for (int i = r[0]; i < r[2]; i++)
+                selected[size_t(j) * width + i] = 1;
+    }
+    if (!opts.region_mask_path.empty()) {
+        rgb_image mask;
+        if (!load_ppm(opts.region_mask_path, mask)) return false;
+        if (mask.width != width || mask.height != height) {
+            std::cerr << "Region mask resolution does not match the camera"
+                      << std::endl;
+            return false;
+        }
+        for (size_t p = 0; p < selected.size(); p++)
+            if (mask.rgb[3 * p] || mask.rgb[3 * p + 1] || mask.rgb[3 * p + 2])
+                selected[p] = 1;
+    }
+
+    for (size_t p = 0; p < selected.size(); p++)
+        if (selected[p]) pixels.push_back(p);
+    return true;
+}
+
+/* Fix-up render: re-renders the pixels selected by --region and
+ * --region-mask to --spp and patches them into `opts.patch_path` in place.
+ * A checkpoint keeps its seed, so the new pixels use the random streams of
+ * the original render; it is saved back and the whole image goes to stdout.
+ * A PPM image gets the new pixels written over its own.
+ */
+static bool run_patch(Allocator& world, const cu_camera& cam,
+                      const render_options& opts) {
+    std::vector<unsigned int> pixels;
+    if (!select_region(opts, cam.image_width, cam.image_height, pixels))
+        return false;
+
+    char magic[4] = {};
+    {
+        std::ifstream in(opts.patch_path, std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open " << opts.patch_path << std::endl;
+            return false;
+        }
+        in.read(magic, 4);
+    }
+    bool checkpoint = std::memcmp(magic, "RTCK", 4) == 0;
+
+    render_buffer buffer(cam.image_width, cam.image_height, opts.seed);
+    rgb_image image;
+    if (checkpoint ? !load_checkpoint(opts.patch_path, buffer)
+                   : !load_ppm(opts.patch_path, image))
+        return false;
+    if (checkpoint ? buffer.width != cam.image_width ||
+                         buffer.height != cam.image_height
+                   : image.width != cam.image_width ||
+                         image.height != cam.image_height) {
+        std::cerr << "Resolution of " << opts.patch_path
+                  << " does not match the camera" << std::endl;
+        return false;
+    }
+
+    if (!world.render_region(cam, buffer, pixels, opts)) return false;
+
+    if (checkpoint) {
+        if (!save_checkpoint(opts.patch_path, buffer)) return false;
+        write_ppm(std::cout, buffer);
+        return true;
+    }
+
+    // Written next to the image in its own format (P3 or P6) and renamed
+    // over it, like checkpoints.
+    for (unsigned int p : pixels)
+        color_to_bytes(buffer.resolve(p), &image.rgb[size_t(p) * 3]);
+    bool binary = magic[1] == '6';
+    std::string temp = opts.patch_path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        out << (binary ? "P6\n" : "P3\n") << image.width << ' '
+            << image.height << "\n255\n";
+        if (binary)
+            out.write(reinterpret_cast<const char*>(image.rgb.data()),
+                      image.rgb.size());
+        else
+            for (size_t p = 0; p < size_t(image.width) * image.height; p++)
+                out << int(image.rgb[3 * p]) << ' '
+                    << int(image.rgb[3 * p + 1]) << ' '
+                    << int(image.rgb[3 * p + 2]) << '\n';
+        if (!out) {
+            std::cerr << "Could not write " << temp << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), opts.patch_path.c_str()) != 0) {
+        std::cerr << "Could not replace " << opts.patch_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    render_options opts;
+    if (!parse_options(argc, argv, opts)) return 1;
+    trace::set_thread_name("main");
+
+    // Stay next to the GPU: the host pages this thread touches (managed
+    // buffers, scene uploads) are then placed on the node of its PCIe link.
+    if (numa_topology::system().nodes() > 1) {
+        int node = device_numa_node(0);
+        if (node >= 0 && pin_thread_to_node(node))
+            std::clog << "Pinned to NUMA node "
+                      << numa_topology::system().node_ids[node] << " ("
+                      << numa_topology::system().nodes() << " nodes)"
+                      << std::endl;
+    }
+
+    Allocator world;
+    paged_scene paged;
+
+    if (!opts.write_scene_path.empty())
+        return write_random_scene(opts.write_scene_path, opts.scene_spheres)
+                   ? 0
+                   : 1;
+
+    {
+        TRACE_SCOPE("scene build");
+        if (opts.scene_path.empty()) {
+            if (!build_default_scene(world, opts)) return 1;
+        } else {
+            if (!paged.open(opts.scene_path, opts.cache_mb << 20)) return 1;
+            if (world.allocate_paged_scene(paged) == nullptr) return 1;
+        }
+    }
 
     cu_camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 1200;
-    cam.samples_per_pixel = 500;
+    cam.image_width       = opts.width;
+    cam.samples_per_pixel = opts.samples_per_pixel;
     cam.max_depth         = 50;
 
     cam.fov     = 20;
@@ -111,17 +497,99 @@ int main() {
 
     cam.defocus_angle = 0.6;
     cam.focus_distance    = 10.0;
+    cam.ao_distance       = opts.ao_distance;
+
+    if (!opts.environment_path.empty()) {
+        cam.environment = world.allocate_environment(opts.environment_path);
+        if (cam.environment == nullptr) return 1;
+    }
 
     cam.initialize();
 
-    color3* output = new color3[cam.image_height * cam.image_width];
-    world.test(cam, output);
+    if (opts.irradiance_cache_pixels > 0) {
+        cam.irradiance_cache =
+            world.allocate_irradiance_cache(cam, opts.irradiance_cache_pixels);
+        if (cam.irradiance_cache == nullptr) return 1;
+    }
 
-    std::cout << "P3\n" << cam.image_width << ' ' << cam.image_height <<
-    "\n255\n";
+    if (!opts.sequence_path.empty()) {
+        bool ok = run_sequence(world, cam, opts);
+        if (!opts.trace_path.empty()) trace::dump(opts.trace_path);
+        return ok ? 0 : 1;
+    }
 
-    for (int i=0; i<cam.image_height * cam.image_width; i++)
-        write_color(std::cout, output[i]);
+    if (!opts.patch_path.empty()) {
+        bool ok = run_patch(world, cam, opts);
+        if (!opts.trace_path.empty()) trace::dump(opts.trace_path);
+        return ok ? 0 : 1;
+    }
+
+    if (!opts.views_path.empty()) {
+        std::vector<render_view> views;
+        if (!load_views(opts.views_path, cam, views)) return 1;
+        // `world` outlives the batch.
+        std::shared_ptr<const Allocator> scene(&world, [](const Allocator*) {});
+        bool ok = render_batch(
+            scene, views, opts, [&](size_t i, const job_result& res) {
+                std::ofstream out(views[i].output);
+                write_ppm(out, res.buffer);
+                if (!out) {
+                    std::cerr << "Could not write " << views[i].output
+                              << std::endl;
+                    return false;
+                }
+                return true;
+            });
+        if (!opts.trace_path.empty()) trace::dump(opts.trace_path);
+        return ok ? 0 : 1;
+    }
+
+    if (opts.stream) {
+        bool ok = render_streaming(world, cam, opts, std::cout);
+        if (!opts.trace_path.empty()) trace::dump(opts.trace_path);
+        return ok ? 0 : 1;
+    }
+
+    render_buffer buffer(cam.image_width, cam.image_height, opts.seed);
+    if (!opts.resume_path.empty()) {
+        if (!load_checkpoint(opts.resume_path, buffer)) return 1;
+        if (buffer.width != cam.image_width ||
+            buffer.height != cam.image_height) {
+            std::cerr << "Checkpoint resolution does not match the camera"
+                      << std::endl;
+            return 1;
+        }
+        std::clog << "Resuming at " << buffer.min_samples()
+                  << " samples per pixel" << std::endl;
+    }
+
+    if (!opts.aov_prefix.empty()) buffer.track_aovs();
+    if (!opts.lookdev_path.empty()) {
+        buffer.track_materials();
+        // Checkpoints carry no masks: any edit re-renders resumed pixels.
+        if (!opts.resume_path.empty())
+            std::fill(buffer.material_masks.begin(),
+                      buffer.material_masks.end(), ~0ull);
+    }
+
+    {
+        TRACE_SCOPE("render");
+        if (!world.render(cam, buffer, opts)) return 1;
+    }
+
+    if (!opts.aov_prefix.empty()) {
+        write_aov(opts.aov_prefix + ".normal.ppm", buffer, buffer.aov_normal,
+                  -1, 1);
+        write_aov(opts.aov_prefix + ".albedo.ppm", buffer, buffer.aov_albedo,
+                  0, 1);
+    }
+
+    if (!opts.lookdev_path.empty() && !run_lookdev(world, cam, buffer, opts))
+        return 1;
+
+    write_ppm(std::cout, buffer);
+
+    if (!opts.trace_path.empty()) trace::dump(opts.trace_path);
 
     return 0;
 }
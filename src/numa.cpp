@@ -0,0 +1,114 @@
+#include "numa.hpp"
+
+#include <cuda_runtime_api.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Parses a sysfs CPU or node list such as "0-7,16-23".
+static std::vector<int> parse_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || !std::isdigit((unsigned char)range[0])) continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first
+                                             : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+static numa_topology detect_topology() {
+    numa_topology topo;
+    // Node ids need not be contiguous, so take them from the online list
+    // rather than counting up until one is missing.
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    std::getline(online, nodes);
+    for (int node : parse_list(nodes)) {
+        std::ifstream in("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+        std::string list;
+        std::getline(in, list);
+        std::vector<int> cpus = parse_list(list);
+        // Memory-only nodes get no workers.
+        if (cpus.empty()) continue;
+        topo.node_cpus.push_back(cpus);
+        topo.node_ids.push_back(node);
+    }
+
+    if (topo.node_cpus.empty()) {
+        std::vector<int> all;
+        unsigned int n = std::thread::hardware_concurrency();
+        for (unsigned int cpu = 0; cpu < (n ? n : 1); cpu++) all.push_back(cpu);
+        topo.node_cpus.push_back(all);
+        topo.node_ids.assign(1, 0);
+    }
+    return topo;
+}
+
+int numa_topology::index_of(int id) const {
+    for (size_t i = 0; i < node_ids.size(); i++)
+        if (node_ids[i] == id) return int(i);
+    return -1;
+}
+
+const numa_topology& numa_topology::system() {
+    static const numa_topology topo = detect_topology();
+    return topo;
+}
+
+bool pin_thread_to_node(int node) {
+    const numa_topology& topo = numa_topology::system();
+    if (node < 0 || size_t(node) >= topo.nodes()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : topo.node_cpus[node])
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int device_numa_node(int device) {
+    char bus_id[32];
+    if (cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), device) != cudaSuccess)
+        return -1;
+
+    // sysfs names devices in lower case.
+    std::string id(bus_id);
+    for (char& c : id) c = std::tolower((unsigned char)c);
+    std::ifstream in("/sys/bus/pci/devices/" + id + "/numa_node");
+    int node = -1;
+    if (!(in >> node) || node < 0) return -1;
+    return numa_topology::system().index_of(node);
+}
+
+std::vector<int> page_nodes(const void* data, size_t bytes) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(data) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(data) + bytes;
+    size_t count = (end - start + page - 1) / page;
+
+    std::vector<void*> pages(count);
+    for (size_t i = 0; i < count; i++)
+        pages[i] = reinterpret_cast<void*>(start + i * page);
+
+    // move_pages without target nodes only reports the current placement.
+    std::vector<int> status(count, -1);
+    if (count > 0 && syscall(SYS_move_pages, 0, count, pages.data(), nullptr,
+                             status.data(), 0) != 0)
+        status.assign(count, -1);
+    const numa_topology& topo = numa_topology::system();
+    for (int& s : status) s = s < 0 ? -1 : topo.index_of(s);
+    return status;
+}
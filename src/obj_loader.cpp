@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "mesh.hpp"
+#include "trace.hpp"
+
+namespace {
+
+// Geometry parsed from one chunk of lines. Relative (negative) face indices
+// can only be resolved once the vertex counts of earlier chunks are known, so
+// they are stored relative to the chunk and flagged in `relative`.
+struct obj_chunk {
+    std::vector<mesh_vertex> vertices;
+    std::vector<mesh_vertex> normals;
+    std::vector<mesh_triangle> triangles;
+    std::vector<unsigned char> relative;  // Bit k: v[k], bit 3 + k: n[k]
+    const char* bad_line = nullptr;       // First malformed line, if any
+};
+
+struct face_corner {
+    int v, n;
+    bool v_relative, n_relative;
+};
+
+inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+inline const char* skip_line(const char* p, const char* end) {
+    while (p < end && *p != '\n') p++;
+    return p < end ? p + 1 : end;
+}
+
+inline const char* parse_int(const char* p, const char* end, int& value) {
+    bool negative = p < end && *p == '-';
+    if (negative || (p < end && *p == '+')) p++;
+    int x = 0;
+    const char* start = p;
+    while (p < end && *p >= '0' && *p <= '9') x = x * 10 + (*p++ - '0');
+    if (p == start) return nullptr;
+    value = negative ? -x : x;
+    return p;
+}
+
+// Parses three coordinates. strtof would skip newlines along with other
+// white space, so each number has to start on the current line.
+inline const char* parse_vertex(const char* p, const char* end,
+                                mesh_vertex& v) {
+    float* xyz[3] = {&v.x, &v.y, &v.z};
+    for (float* c : xyz) {
+        p = skip_space(p, end);
+        if (p == end || *p == '\n') return nullptr;
+        char* next;
+        *c = std::strtof(p, &next);
+        if (next == p) return nullptr;
+        p = next;
+    }
+    return p;
+}
+
+// Resolves an OBJ index (1-based, or negative relative to the element count
+// so far) to a 0-based index, relative to the chunk for negative indices.
+inline void resolve_index(int index, size_t count, int& out, bool& relative) {
+    relative = index < 0;
+    out = relative ? int(count) + index : index - 1;
+}
+
+// Parses "v", "v/vt", "v//vn" or "v/vt/vn".
+inline const char* parse_corner(const char* p, const char* end,
+                                const obj_chunk& chunk, face_corner& c) {
+    int v, n = 0;
+    p = parse_int(p, end, v);
+    if (p == nullptr) return nullptr;
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/') {
+            int vt;
+            p = parse_int(p, end, vt);
+            if (p == nullptr) return nullptr;
+        }
+        if (p < end && *p == '/') {
+            p = parse_int(p + 1, end, n);
+            if (p == nullptr) return nullptr;
+        }
+    }
+
+    resolve_index(v, chunk.vertices.size(), c.v, c.v_relative);
+    if (n == 0) {
+        c.n = -1;
+        c.n_relative = false;
+    } else {
+        resolve_index(n, chunk.normals.size(), c.n, c.n_relative);
+    }
+    return p;
+}
+
+void parse_chunk(const char* p, const char* end, obj_chunk& chunk) {
+    TRACE_SCOPE_ARG("obj parse chunk", "bytes", (long long)(end - p));
+    std::vector<face_corner> corners;
+
+    while (p < end) {
+        p = skip_space(p, end);
+        if (p + 1 >= end) break;
+
+        if (p[0] == 'v' && is_space(p[1])) {
+            mesh_vertex v;
+            if (parse_vertex(p + 2, end, v) == nullptr) {
+                chunk.bad_line = p;
+                return;
+            }
+            chunk.vertices.push_back(v);
+        } else if (p[0] == 'v' && p[1] == 'n' && p + 2 < end &&
+                   is_space(p[2])) {
+            mesh_vertex n;
+            if (parse_vertex(p + 3, end, n) == nullptr) {
+                chunk.bad_line = p;
+                return;
+            }
+            chunk.normals.push_back(n);
+        } else if (p[0] == 'f' && is_space(p[1])) {
+            corners.clear();
+            const char* q = skip_space(p + 2, end);
+            while (q < end && *q != '\n' && *q != '#') {
+                face_corner c;
+                q = parse_corner(q, end, chunk, c);
+                if (q == nullptr) {
+                    chunk.bad_line = p;
+                    return;
+                }
+                corners.push_back(c);
+                q = skip_space(q, end);
+            }
+            if (corners.size() < 3) {
+                chunk.bad_line = p;
+                return;
+            }
+
+            // Fan triangulation. Normals are only used when every corner
+            // of the face has one.
+            bool has_normals = true;
+            for (const face_corner& c : corners)
+                if (c.n < 0 && !c.n_relative) has_normals = false;
+
+            for (size_t k = 1; k + 1 < corners.size(); k++) {
+                const face_corner* tri[3] = {&corners[0], &corners[k],
+                                             &corners[k + 1]};
+                mesh_triangle t;
+                unsigned char relative = 0;
+                for (int j = 0; j < 3; j++) {
+                    t.v[j] = tri[j]->v;
+                    t.n[j] = has_normals ? tri[j]->n : -1;
+                    if (tri[j]->v_relative) relative |= 1 << j;
+                    if (has_normals && tri[j]->n_relative)
+                        relative |= 1 << (3 + j);
+                }
+                chunk.triangles.push_back(t);
+                chunk.relative.push_back(relative);
+            }
+        }
+
+        p = skip_line(p, end);
+    }
+}
+
+}  // namespace
+
+bool load_obj(const std::string& path, triangle_mesh& mesh) {
+    TRACE_SCOPE("obj load");
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "Could not open OBJ file " << path << std::endl;
+        return false;
+    }
+    std::string text(size_t(in.tellg()), '\0');
+    in.seekg(0);
+    in.read(&text[0], text.size());
+    if (!in) {
+        std::cerr << "Could not read OBJ file " << path << std::endl;
+        return false;
+    }
+
+    // Split at line boundaries into chunks of at least 1 MB, one per thread.
+    const char* begin = text.c_str();
+    const char* end = begin + text.size();
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, text.size() / (1 << 20) + 1);
+
+    std::vector<const char*> bounds{begin};
+    for (size_t i = 1; i < threads; i++) {
+        const char* p = begin + text.size() * i / threads;
+        p = std::max(p, bounds.back());
+        bounds.push_back(skip_line(p, end));
+    }
+    bounds.push_back(end);
+
+    std::vector<obj_chunk> chunks(threads);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++)
+        workers.emplace_back(parse_chunk, bounds[i], bounds[i + 1],
+                             std::ref(chunks[i]));
+    parse_chunk(bounds[0], bounds[1], chunks[0]);
+    for (auto& w : workers) w.join();
+
+    size_t num_vertices = 0, num_normals = 0, num_triangles = 0;
+    for (const obj_chunk& c : chunks) {
+        if (c.bad_line != nullptr) {
+            std::cerr << "Malformed line "
+                      << std::count(begin, c.bad_line, '\n') + 1
+                      << " in OBJ file " << path << std::endl;
+            return false;
+        }
+        num_vertices += c.vertices.size();
+        num_normals += c.normals.size();
+        num_triangles += c.triangles.size();
+    }
+
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.triangles.clear();
+    mesh.vertices.reserve(num_vertices);
+    mesh.normals.reserve(num_normals);
+    mesh.triangles.reserve(num_triangles);
+
+    for (const obj_chunk& c : chunks) {
+        int vertex_offset = mesh.vertices.size();
+        int normal_offset = mesh.normals.size();
+        for (size_t i = 0; i < c.triangles.size(); i++) {
+            mesh_triangle t = c.triangles[i];
+            for (int j = 0; j < 3; j++) {
+                bool relative_normal = c.relative[i] & (1 << (3 + j));
+                if (c.relative[i] & (1 << j)) t.v[j] += vertex_offset;
+                if (relative_normal) t.n[j] += normal_offset;
+
+                // -1 only stands for "no normal" when the parser set it; a
+                // relative index can resolve to -1 as well.
+                bool no_normal = t.n[j] == -1 && !relative_normal;
+                bool valid = t.v[j] >= 0 && size_t(t.v[j]) < num_vertices &&
+                             (no_normal || (t.n[j] >= 0 &&
+                                            size_t(t.n[j]) < num_normals));
+                if (!valid) {
+                    std::cerr << "Invalid face index in OBJ file " << path
+                              << std::endl;
+                    return false;
+                }
+            }
+            mesh.triangles.push_back(t);
+        }
+        mesh.vertices.insert(mesh.vertices.end(), c.vertices.begin(),
+                             c.vertices.end());
+        mesh.normals.insert(mesh.normals.end(), c.normals.begin(),
+                            c.normals.end());
+    }
+
+    if (mesh.triangles.empty()) {
+        std::cerr << "No faces in OBJ file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
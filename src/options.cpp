@@ -0,0 +1,311 @@
+#include "options.hpp"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options] > image.ppm\n"
+        << "  --spp N                  total samples per pixel (default 500)\n"
+        << "  --pass-samples N         samples per pixel per pass (default 4)\n"
+        << "  --seed N                 random seed (default 42)\n"
+        << "  --width N                image width (default 1200)\n"
+        << "  --checkpoint FILE        periodically save progress to FILE\n"
+        << "  --checkpoint-interval S  seconds between checkpoints (default "
+           "300)\n"
+        << "  --resume FILE            continue from checkpoint FILE; with a\n"
+        << "                           higher --spp adds samples to a\n"
+        << "                           finished render\n"
+        << "  --time-budget S          stop after the last pass that fits "
+           "into S seconds\n"
+        << "  --target-error E         stop once the estimated relative "
+           "error is below E\n"
+        << "  --scene FILE             render an out-of-core scene file\n"
+        << "  --cache-mb N             device cache for --scene (default "
+           "1024)\n"
+        << "  --obj FILE               add an OBJ mesh to the built-in scene\n"
+        << "  --fog DENSITY            fill the built-in scene with fog "
+           "scattering\n"
+        << "                           DENSITY per unit length\n"
+        << "  --volume FILE            add a heterogeneous medium from a "
+           "Mitsuba .vol\n"
+        << "                           grid to the built-in scene\n"
+        << "  --volume-density S       scale of the --volume densities "
+           "(default 1)\n"
+        << "  --texture FILE           texture a sphere of the built-in scene "
+           "with a PPM image\n"
+        << "  --noise-scale S          marble texture on the ground, S "
+           "stripes per unit\n"
+        << "  --texture-cache-mb N     device cache for image textures "
+           "(default 256)\n"
+        << "  --environment FILE       light the scene with an "
+           "equirectangular\n"
+        << "                           PFM or Radiance HDR image\n"
+        << "  --lookdev FILE           after rendering, read material edits "
+           "from stdin\n"
+        << "                           and write each result to FILE\n"
+        << "  --aov PREFIX             also write first hit normal and "
+           "albedo images\n"
+        << "  --stats                  report the number of rays traced\n"
+        << "  --irradiance-cache PX    reuse indirect diffuse light from "
+           "cells PX\n"
+        << "                           pixels wide (biased; 0: off)\n"
+        << "  --ao DIST                fast clay preview with ambient "
+           "occlusion\n"
+        << "                           up to DIST (default 64 samples)\n"
+        << "  --stream                 write a binary PPM band by band, "
+           "without\n"
+        << "                           holding the whole image in memory\n"
+        << "  --views FILE             render every view listed in FILE "
+           "into its\n"
+        << "                           own image, sharing the scene\n"
+        << "  --patch FILE             re-render only --region and "
+           "--region-mask and\n"
+        << "                           patch them into the checkpoint or PPM "
+           "FILE\n"
+        << "  --region X0,Y0,X1,Y1     pixel rectangle for --patch (X1, Y1 "
+           "exclusive)\n"
+        << "  --region-mask FILE       PPM selecting pixels for --patch "
+           "(non-black)\n"
+        << "  --sequence FILE          render the views in FILE in order as "
+           "frames of a\n"
+        << "                           camera move, reusing each frame in "
+           "the next\n"
+        << "  --fresh-samples N        new samples per pixel and frame of "
+           "--sequence\n"
+        << "                           (default 4)\n"
+        << "  --trace FILE             write a timeline of the render to "
+           "FILE\n"
+        << "  --write-scene FILE       write a random test scene file and "
+           "exit\n"
+        << "  --spheres N              spheres of --write-scene (default "
+           "1000000)\n";
+}
+
+bool parse_options(int argc, char** argv, render_options& opts) {
+    bool spp_given = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return false;
+        }
+
+        if (std::strcmp(arg, "--stats") == 0) {
+            opts.stats = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--stream") == 0) {
+            opts.stream = true;
+            continue;
+        }
+
+        if (!has_value) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--spp") == 0) {
+            opts.samples_per_pixel = std::atoi(value);
+            spp_given = true;
+        } else if (std::strcmp(arg, "--pass-samples") == 0) {
+            opts.pass_samples = std::atoi(value);
+        } else if (std::strcmp(arg, "--seed") == 0) {
+            opts.seed = std::strtoull(value, nullptr, 10);
+        } else if (std::strcmp(arg, "--width") == 0) {
+            opts.width = std::atoi(value);
+        } else if (std::strcmp(arg, "--checkpoint") == 0) {
+            opts.checkpoint_path = value;
+        } else if (std::strcmp(arg, "--checkpoint-interval") == 0) {
+            opts.checkpoint_interval = std::atof(value);
+        } else if (std::strcmp(arg, "--resume") == 0) {
+            opts.resume_path = value;
+        } else if (std::strcmp(arg, "--time-budget") == 0) {
+            opts.time_budget = std::atof(value);
+        } else if (std::strcmp(arg, "--target-error") == 0) {
+            opts.target_error = std::atof(value);
+        } else if (std::strcmp(arg, "--scene") == 0) {
+            opts.scene_path = value;
+        } else if (std::strcmp(arg, "--cache-mb") == 0) {
+            opts.cache_mb = std::strtoull(value, nullptr, 10);
+        } else if (std::strcmp(arg, "--obj") == 0) {
+            opts.obj_path = value;
+        } else if (std::strcmp(arg, "--fog") == 0) {
+            opts.fog_density = std::atof(value);
+        } else if (std::strcmp(arg, "--volume") == 0) {
+            opts.volume_path = value;
+        } else if (std::strcmp(arg, "--volume-density") == 0) {
+            opts.volume_density = std::atof(value);
+        } else if (std::strcmp(arg, "--texture") == 0) {
+            opts.texture_path = value;
+        } else if (std::strcmp(arg, "--noise-scale") == 0) {
+            opts.noise_scale = std::atof(value);
+        } else if (std::strcmp(arg, "--environment") == 0) {
+            opts.environment_path = value;
+        } else if (std::strcmp(arg, "--texture-cache-mb") == 0) {
+            opts.texture_cache_mb = std::strtoull(value, nullptr, 10);
+        } else if (std::strcmp(arg, "--lookdev") == 0) {
+            opts.lookdev_path = value;
+        } else if (std::strcmp(arg, "--aov") == 0) {
+            opts.aov_prefix = value;
+        } else if (std::strcmp(arg, "--irradiance-cache") == 0) {
+            opts.irradiance_cache_pixels = std::atof(value);
+        } else if (std::strcmp(arg, "--ao") == 0) {
+            opts.ao_distance = std::atof(value);
+        } else if (std::strcmp(arg, "--views") == 0) {
+            opts.views_path = value;
+        } else if (std::strcmp(arg, "--patch") == 0) {
+            opts.patch_path = value;
+        } else if (std::strcmp(arg, "--region") == 0) {
+            int* r = opts.region;
+            if (std::sscanf(value, "%d,%d,%d,%d", &r[0], &r[1], &r[2],
+                            &r[3]) != 4 ||
+                r[0] < 0 || r[1] < 0 || r[2] <= r[0] || r[3] <= r[1]) {
+                std::cerr << "--region needs X0,Y0,X1,Y1 with X0 < X1 and "
+                             "Y0 < Y1"
+                          << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(arg, "--region-mask") == 0) {
+            opts.region_mask_path = value;
+        } else if (std::strcmp(arg, "--sequence") == 0) {
+            opts.sequence_path = value;
+        } else if (std::strcmp(arg, "--fresh-samples") == 0) {
+            opts.fresh_samples = std::atoi(value);
+        } else if (std::strcmp(arg, "--trace") == 0) {
+            opts.trace_path = value;
+        } else if (std::strcmp(arg, "--write-scene") == 0) {
+            opts.write_scene_path = value;
+        } else if (std::strcmp(arg, "--spheres") == 0) {
+            opts.scene_spheres = std::strtoull(value, nullptr, 10);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (opts.samples_per_pixel < 1 || opts.pass_samples < 1) {
+        std::cerr << "--spp and --pass-samples must be positive" << std::endl;
+        return false;
+    }
+    if (opts.width < 16) {
+        std::cerr << "--width must be at least 16" << std::endl;
+        return false;
+    }
+    if (opts.ao_distance < 0 || opts.irradiance_cache_pixels < 0) {
+        std::cerr << "--ao and --irradiance-cache must not be negative"
+                  << std::endl;
+        return false;
+    }
+    // The cache is filled and frozen by the single image render loop, and
+    // would go stale under material edits. Its cells are sized for one
+    // camera, so the frames of a sequence cannot share it either.
+    if (opts.irradiance_cache_pixels > 0 &&
+        (opts.stream || !opts.views_path.empty() ||
+         !opts.sequence_path.empty() || !opts.lookdev_path.empty())) {
+        std::cerr << "--irradiance-cache cannot be combined with --stream, "
+                     "--views, --sequence or --lookdev"
+                  << std::endl;
+        return false;
+    }
+    if (opts.fog_density < 0 || opts.volume_density < 0) {
+        std::cerr << "--fog and --volume-density must not be negative"
+                  << std::endl;
+        return false;
+    }
+    if (opts.noise_scale < 0 || opts.texture_cache_mb < 1) {
+        std::cerr << "--noise-scale must not be negative and "
+                     "--texture-cache-mb must be positive"
+                  << std::endl;
+        return false;
+    }
+
+    // Streamed pixels are final once written: nothing can be added to them
+    // later or revisited. Batches render through render jobs, which only
+    // take the sample settings.
+    bool single_image_only =
+        !opts.checkpoint_path.empty() || !opts.resume_path.empty() ||
+        opts.time_budget > 0 || opts.target_error > 0 ||
+        !opts.lookdev_path.empty() || !opts.aov_prefix.empty();
+    if (opts.stream && !opts.views_path.empty()) {
+        std::cerr << "--stream and --views cannot be combined" << std::endl;
+        return false;
+    }
+    if ((opts.stream || !opts.views_path.empty()) && single_image_only) {
+        std::cerr << (opts.stream ? "--stream" : "--views")
+                  << " cannot be combined with checkpoints, deadlines, "
+                     "--lookdev or --aov"
+                  << std::endl;
+        return false;
+    }
+    // Frames go through the single image loop one after the other, each to
+    // a fixed sample count that bounds how long history is kept. Deadlines
+    // apply per frame.
+    if (!opts.sequence_path.empty()) {
+        if (opts.stream || !opts.views_path.empty() ||
+            !opts.checkpoint_path.empty() || !opts.resume_path.empty() ||
+            !opts.lookdev_path.empty() || !opts.aov_prefix.empty()) {
+            std::cerr << "--sequence cannot be combined with --stream, "
+                         "--views, checkpoints, --lookdev or --aov"
+                      << std::endl;
+            return false;
+        }
+        if ((opts.time_budget > 0 || opts.target_error > 0) && !spp_given) {
+            std::cerr << "--sequence with a deadline needs --spp"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    // Patches only touch the selected pixels of a single image, once.
+    bool region = opts.region[2] > opts.region[0] ||
+                  !opts.region_mask_path.empty();
+    if (region != !opts.patch_path.empty()) {
+        std::cerr << "--patch needs --region or --region-mask, and they "
+                     "only apply to --patch"
+                  << std::endl;
+        return false;
+    }
+    if (!opts.patch_path.empty() &&
+        (opts.stream || !opts.views_path.empty() ||
+         !opts.sequence_path.empty() || single_image_only ||
+         opts.irradiance_cache_pixels > 0)) {
+        std::cerr << "--patch cannot be combined with --stream, --views, "
+                     "--sequence, checkpoints, deadlines, --lookdev, --aov "
+                     "or --irradiance-cache"
+                  << std::endl;
+        return false;
+    }
+
+#ifndef RT_TRACING
+    if (!opts.trace_path.empty())
+        std::cerr << "Built without ENABLE_TRACING, --trace is ignored"
+                  << std::endl;
+#endif
+
+    bool open_ended = opts.time_budget > 0 || opts.target_error > 0;
+    if (open_ended && !spp_given) opts.samples_per_pixel = INT_MAX;
+    // Occlusion converges much faster than full paths.
+    else if (opts.ao_distance > 0 && !spp_given) opts.samples_per_pixel = 64;
+
+    if (!opts.sequence_path.empty() &&
+        (opts.fresh_samples < 1 ||
+         opts.fresh_samples > opts.samples_per_pixel)) {
+        std::cerr << "--fresh-samples must be between 1 and --spp"
+                  << std::endl;
+        return false;
+    }
+
+    // Resumed renders keep checkpointing into the file they came from.
+    if (opts.checkpoint_path.empty()) opts.checkpoint_path = opts.resume_path;
+
+    return true;
+}
@@ -0,0 +1,386 @@
+#include "paged_scene.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "trace.hpp"
+
+static unsigned long long align_up(unsigned long long x, unsigned long long a) {
+    return (x + a - 1) / a * a;
+}
+
+// Whether `count` elements of `size` bytes at `offset` lie inside the file.
+static bool section_fits(unsigned long long offset, unsigned long long count,
+                         unsigned long long size, unsigned long long file) {
+    return offset <= file && count <= (file - offset) / size;
+}
+
+/* Checks the hierarchy of a scene file before the device walks it unchecked:
+ * every node is reached once, children come after their parent, leaves hold
+ * 1 to sphere_cloud_leaf_size spheres from the start of a frame and inside
+ * the file's spheres, and no leaf is so deep that the traversal stack (one
+ * pending sibling per level) overflows.
+ */
+static bool valid_hierarchy(const cloud_node* nodes,
+                            const scene_file_header& header) {
+    const int leaf_size = sphere_cloud_leaf_size;
+    std::vector<unsigned char> seen(header.num_nodes, 0);
+    std::vector<std::pair<unsigned long long, int>> pending{{0, 0}};
+    while (!pending.empty()) {
+        unsigned long long index = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+        if (depth >= sphere_cloud_stack_size || seen[index]) return false;
+        seen[index] = 1;
+
+        const cloud_node& node = nodes[index];
+        if (node.count == 0) {
+            if (node.first <= 0 || (unsigned long long)node.first <= index ||
+                (unsigned long long)node.first + 1 >= header.num_nodes)
+                return false;
+            pending.push_back({(unsigned long long)node.first, depth + 1});
+            pending.push_back({(unsigned long long)node.first + 1, depth + 1});
+        } else if (node.count < 0 || node.count > leaf_size ||
+                   node.first < 0 || node.first % leaf_size != 0 ||
+                   (unsigned long long)node.first / leaf_size >=
+                       header.num_frames ||
+                   (unsigned long long)node.first + node.count >
+                       header.num_spheres) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool write_scene_file(const std::string& path,
+                      std::vector<sphere_input>& spheres,
+                      const std::vector<material_record>& materials) {
+    TRACE_SCOPE("scene file write");
+    sphere_cloud_data cloud = build_sphere_cloud(spheres);
+
+    scene_file_header header;
+    header.num_materials = materials.size();
+    header.num_nodes = cloud.nodes.size();
+    header.num_frames = cloud.frames.size();
+    header.num_spheres = cloud.spheres.size();
+    header.num_bricks =
+        (cloud.spheres.size() + paged_brick_spheres - 1) / paged_brick_spheres;
+    header.materials_offset = sizeof(scene_file_header);
+    header.nodes_offset = align_up(
+        header.materials_offset + materials.size() * sizeof(material_record),
+        alignof(cloud_node));
+    header.frames_offset =
+        header.nodes_offset + cloud.nodes.size() * sizeof(cloud_node);
+    header.bricks_offset = align_up(
+        header.frames_offset + cloud.frames.size() * sizeof(sphere_frame),
+        paged_page_size);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Could not open scene file " << path << std::endl;
+        return false;
+    }
+
+    auto write_at = [&](unsigned long long offset, const void* data,
+                        size_t bytes) {
+        out.seekp(offset);
+        out.write(static_cast<const char*>(data), bytes);
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(header.materials_offset, materials.data(),
+             materials.size() * sizeof(material_record));
+    write_at(header.nodes_offset, cloud.nodes.data(),
+             cloud.nodes.size() * sizeof(cloud_node));
+    write_at(header.frames_offset, cloud.frames.data(),
+             cloud.frames.size() * sizeof(sphere_frame));
+
+    for (unsigned long long b = 0; b < header.num_bricks; b++) {
+        size_t first = b * paged_brick_spheres;
+        size_t count = std::min<size_t>(paged_brick_spheres,
+                                        cloud.spheres.size() - first);
+        write_at(header.bricks_offset + b * paged_page_size,
+                 &cloud.spheres[first], count * sizeof(packed_sphere));
+    }
+
+    // Pad the last brick to a full page so every brick can be mapped whole.
+    out.seekp(header.bricks_offset + header.num_bricks * paged_page_size - 1);
+    out.put(0);
+    out.close();
+
+    if (!out) {
+        std::cerr << "Could not write scene file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+paged_scene::~paged_scene() {
+    if (map != nullptr) munmap(map, map_size);
+    if (fd >= 0) close(fd);
+    cudaFree(d_nodes);
+    cudaFree(d_frames);
+    cudaFree(d_slots);
+    cudaFree(brick_slot);
+    cudaFree(requests);
+    cudaFree(touched);
+    cudaFree(fault_flags);
+    cudaFree(fault_cell);
+}
+
+bool paged_scene::open(const std::string& path, size_t cache_bytes) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Could not open scene file " << path << std::endl;
+        return false;
+    }
+
+    map_size = st.st_size;
+    void* mapped = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not map scene file " << path << std::endl;
+        map = nullptr;
+        return false;
+    }
+    map = static_cast<char*>(mapped);
+
+    scene_file_header expected;
+    if (map_size < sizeof(header)) {
+        std::cerr << "Not a scene file: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, map, sizeof(header));
+    if (std::memcmp(header.magic, expected.magic, 4) != 0 ||
+        header.version != expected.version ||
+        header.page_size != expected.page_size || header.num_nodes == 0 ||
+        header.num_materials == 0 ||
+        header.num_bricks != (header.num_spheres + paged_brick_spheres - 1) /
+                                 paged_brick_spheres ||
+        header.materials_offset % alignof(material_record) != 0 ||
+        header.nodes_offset % alignof(cloud_node) != 0 ||
+        header.frames_offset % alignof(sphere_frame) != 0 ||
+        !section_fits(header.materials_offset, header.num_materials,
+                      sizeof(material_record), map_size) ||
+        !section_fits(header.nodes_offset, header.num_nodes,
+                      sizeof(cloud_node), map_size) ||
+        !section_fits(header.frames_offset, header.num_frames,
+                      sizeof(sphere_frame), map_size) ||
+        !section_fits(header.bricks_offset, header.num_bricks, paged_page_size,
+                      map_size)) {
+        std::cerr << "Not a scene file (or unsupported version): " << path
+                  << std::endl;
+        return false;
+    }
+
+    material_table =
+        reinterpret_cast<const material_record*>(map + header.materials_offset);
+    if (!valid_hierarchy(
+            reinterpret_cast<const cloud_node*>(map + header.nodes_offset),
+            header)) {
+        std::cerr << "Corrupt hierarchy in scene file " << path << std::endl;
+        return false;
+    }
+
+    // The hierarchy stays resident.
+    size_t nodes_bytes = header.num_nodes * sizeof(cloud_node);
+    size_t frames_bytes = header.num_frames * sizeof(sphere_frame);
+    cache_bricks = std::min<size_t>(
+        header.num_bricks,
+        cache_bytes / (paged_brick_spheres * sizeof(packed_sphere)));
+    if (cache_bricks < std::min<size_t>(header.num_bricks,
+                                        paged_min_cache_bricks)) {
+        std::cerr << "Device cache too small for scene " << path
+                  << ": needs at least " << paged_min_cache_bricks
+                  << " bricks of "
+                  << paged_brick_spheres * sizeof(packed_sphere) << " bytes"
+                  << std::endl;
+        return false;
+    }
+
+    auto err = cudaMallocManaged(&d_nodes, nodes_bytes);
+    if (err == cudaSuccess) err = cudaMallocManaged(&d_frames, frames_bytes);
+    if (err == cudaSuccess)
+        err = cudaMalloc(&d_slots, cache_bricks * paged_brick_spheres *
+                                       sizeof(packed_sphere));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&brick_slot, header.num_bricks * sizeof(int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&requests,
+                                header.num_bricks * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&touched,
+                                header.num_bricks * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&fault_cell, sizeof(unsigned int*));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate paged scene on the GPU" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        return false;
+    }
+
+    std::memcpy(d_nodes, map + header.nodes_offset, nodes_bytes);
+    std::memcpy(d_frames, map + header.frames_offset, frames_bytes);
+    std::fill(brick_slot, brick_slot + header.num_bricks, -1);
+    std::fill(requests, requests + header.num_bricks, 0u);
+    std::fill(touched, touched + header.num_bricks, 0u);
+    *fault_cell = nullptr;
+
+    slot_brick.assign(cache_bricks, -1);
+    free_slots.clear();
+    for (size_t i = cache_bricks; i > 0; i--) free_slots.push_back(i - 1);
+
+    counters = paging_stats();
+    counters.bricks = header.num_bricks;
+    counters.cache_bricks = cache_bricks;
+    return true;
+}
+
+aabb paged_scene::bounds() const {
+    const cloud_node* root =
+        reinterpret_cast<const cloud_node*>(map + header.nodes_offset);
+    return aabb(point3(root->lo[0], root->lo[1], root->lo[2]),
+                point3(root->hi[0], root->hi[1], root->hi[2]));
+}
+
+const char* paged_scene::brick_data(size_t brick) const {
+    return map + header.bricks_offset + brick * paged_page_size;
+}
+
+void paged_scene::advise(size_t brick, int advice) const {
+    // madvise wants addresses aligned to the system page, which may be larger
+    // than a brick.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t offset = header.bricks_offset + brick * paged_page_size;
+    size_t start = offset / page * page;
+    madvise(map + start, offset + paged_page_size - start, advice);
+}
+
+int paged_scene::take_slot() {
+    if (!free_slots.empty()) {
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    // Clock replacement: bricks used since the hand last passed get a second
+    // chance, bricks uploaded in the current batch are never evicted.
+    while (true) {
+        size_t slot = clock_hand;
+        clock_hand = (clock_hand + 1) % cache_bricks;
+
+        long long brick = slot_brick[slot];
+        if (pinned[slot]) continue;
+        if (touched[brick]) {
+            touched[brick] = 0;
+            continue;
+        }
+
+        brick_slot[brick] = -1;
+        evicted.push_back(brick);
+        counters.evictions++;
+        return slot;
+    }
+}
+
+size_t paged_scene::service() {
+    TRACE_SCOPE("page in");
+    std::vector<size_t> wanted;
+    for (size_t b = 0; b < header.num_bricks; b++) {
+        if (!requests[b]) continue;
+        requests[b] = 0;
+        if (brick_slot[b] < 0) wanted.push_back(b);
+    }
+    if (wanted.empty()) return 0;
+
+    // Leave room for the bricks the relaunch will touch again.
+    size_t limit = std::max<size_t>(1, cache_bricks / 2);
+    if (wanted.size() > limit) wanted.resize(limit);
+
+    // Start all reads before copying so the disk can work on them at once.
+    for (size_t b : wanted) advise(b, MADV_WILLNEED);
+
+    pinned.assign(cache_bricks, 0);
+    for (size_t b : wanted) {
+        int slot = take_slot();
+        size_t count = std::min<size_t>(
+            paged_brick_spheres, header.num_spheres - b * paged_brick_spheres);
+        const packed_sphere* data =
+            reinterpret_cast<const packed_sphere*>(brick_data(b));
+        // The device looks materials up unchecked; the file is only read
+        // brick by brick, so bad indices are caught here.
+        packed_sphere checked[paged_brick_spheres];
+        for (size_t i = 0; i < count; i++)
+            if (data[i].material >= header.num_materials) {
+                std::copy(data, data + count, checked);
+                for (size_t k = i; k < count; k++)
+                    if (checked[k].material >= header.num_materials)
+                        checked[k].material = 0;
+                if (!bad_materials_reported)
+                    std::cerr << "Scene file refers to missing materials; "
+                                 "using the first one instead"
+                              << std::endl;
+                bad_materials_reported = true;
+                data = checked;
+                break;
+            }
+        cudaMemcpy(d_slots + size_t(slot) * paged_brick_spheres, data,
+                   count * sizeof(packed_sphere), cudaMemcpyHostToDevice);
+
+        brick_slot[b] = slot;
+        slot_brick[slot] = b;
+        pinned[slot] = 1;
+        touched[b] = 1;
+
+        // The data now lives in the device cache; let the kernel drop the
+        // pages so host memory stays bounded as well.
+        advise(b, MADV_DONTNEED);
+        counters.loads++;
+    }
+
+    counters.relaunches++;
+    return wanted.size();
+}
+
+void paged_scene::prefetch() {
+    for (long long b : evicted)
+        if (brick_slot[b] < 0) advise(b, MADV_WILLNEED);
+    evicted.clear();
+}
+
+unsigned int* paged_scene::faults(size_t threads) {
+    if (threads > fault_capacity) {
+        cudaFree(fault_flags);
+        fault_flags = nullptr;
+        if (cudaMallocManaged(&fault_flags, threads * sizeof(unsigned int)) !=
+            cudaSuccess) {
+            std::cerr << "Could not allocate fault flags" << std::endl;
+            fault_capacity = 0;
+            return nullptr;
+        }
+        fault_capacity = threads;
+        *fault_cell = fault_flags;
+    }
+    return fault_flags;
+}
+
+paging_stats paged_scene::stats() {
+    paging_stats s = counters;
+    s.resident_bricks = cache_bricks - free_slots.size();
+    for (size_t b = 0; b < header.num_bricks; b++)
+        if (touched[b]) s.touched_bricks++;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> in_core((map_size + page - 1) / page);
+    if (mincore(map, map_size, in_core.data()) == 0)
+        for (unsigned char c : in_core)
+            if (c & 1) s.host_resident_bytes += page;
+    return s;
+}
@@ -0,0 +1,230 @@
+#include "render_job.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+// Every pool worker queues its kernels on a stream of its own, so tiles of
+// different jobs run concurrently on the device.
+static cudaStream_t worker_stream() {
+    static thread_local cudaStream_t stream = nullptr;
+    if (stream == nullptr) cudaStreamCreate(&stream);
+    return stream;
+}
+
+// New jobs clear their buffers on a stream that does not wait for the
+// kernels of running jobs, so submitting never stalls on them.
+static cudaStream_t setup_stream() {
+    static cudaStream_t stream = [] {
+        cudaStream_t s = nullptr;
+        cudaStreamCreateWithFlags(&s, cudaStreamNonBlocking);
+        return s;
+    }();
+    return stream;
+}
+
+std::shared_ptr<render_job> submit_render_job(
+    std::shared_ptr<const Allocator> scene, const cu_camera& cam,
+    const render_options& opts, job_settings settings) {
+    std::shared_ptr<render_job> job(new render_job());
+    job->scene = scene;
+    job->opts = opts;
+    job->settings = settings;
+    job->result = job->promise.get_future().share();
+
+    // Tiles render without a pager to service their faults.
+    const char* invalid = nullptr;
+    if (scene->pager != nullptr)
+        invalid = "Render jobs do not support paged scenes";
+    else if (settings.tile_size <= 0)
+        invalid = "Render job tile size must be positive";
+    else if (opts.samples_per_pixel < 1 || opts.pass_samples < 1)
+        invalid = "Render job sample counts must be positive";
+    if (invalid != nullptr) {
+        std::cerr << invalid << std::endl;
+        job_result failed;
+        failed.ok = false;
+        job->deliver(std::move(failed));
+        return job;
+    }
+
+    cu_camera* d_cam = nullptr;
+    size_t pixels = size_t(cam.image_width) * cam.image_height;
+    render_target& target = job->target;
+    target.width = cam.image_width;
+    target.height = cam.image_height;
+    target.seed = opts.seed;
+    target.window = tile{0, 0, target.width, target.height};
+    target.accum = nullptr;
+    target.samples = nullptr;
+    target.lum_sq = nullptr;
+
+    // No tile would ever finish an empty image's job, so finish it here.
+    if (pixels == 0) {
+        job_result res;
+        res.buffer = render_buffer(target.width, target.height, target.seed);
+        job->deliver(std::move(res));
+        return job;
+    }
+
+    cudaError_t err = cudaMallocManaged(&d_cam, sizeof(cu_camera));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.accum, pixels * sizeof(color3));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.samples, pixels * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&target.lum_sq, pixels * sizeof(double));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate render job on the GPU" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        cudaFree(d_cam);
+        cudaFree(target.accum);
+        cudaFree(target.samples);
+        cudaFree(target.lum_sq);
+        job_result failed;
+        failed.ok = false;
+        job->deliver(std::move(failed));
+        return job;
+    }
+
+    *d_cam = cam;
+    job->d_cam = d_cam;
+    job->features = scene->render_features(cam, false, false);
+
+    // Cleared on the device, so no host thread places the pages.
+    cudaStream_t setup = setup_stream();
+    cudaMemsetAsync(target.accum, 0, pixels * sizeof(color3), setup);
+    cudaMemsetAsync(target.samples, 0, pixels * sizeof(unsigned int), setup);
+    cudaMemsetAsync(target.lum_sq, 0, pixels * sizeof(double), setup);
+    cudaStreamSynchronize(setup);
+
+    job->output = render_buffer(target.width, target.height, target.seed,
+                                render_buffer::uninitialized);
+
+    job->tiles = make_tiles(target.width, target.height, settings.tile_size);
+    job->remaining_tiles = job->tiles.size();
+    long long passes_per_tile =
+        ((long long)opts.samples_per_pixel + opts.pass_samples - 1) /
+        opts.pass_samples;
+    job->total_passes = std::max(1LL, passes_per_tile * (long long)job->tiles.size());
+
+    for (size_t i = 0; i < job->tiles.size(); i++)
+        thread_pool::global().submit(
+            settings.priority,
+            [job, i] { render_job::run_tile(job, i, 0); },
+            job->tile_node(i));
+
+    return job;
+}
+
+int render_job::tile_node(size_t index) const {
+    size_t nodes = thread_pool::global().nodes();
+    if (nodes < 2) return -1;
+    return int(size_t(tiles[index].y0) * nodes / size_t(target.height));
+}
+
+void render_job::run_tile(std::shared_ptr<render_job> job, size_t index,
+                          unsigned int done) {
+    unsigned int goal = job->opts.samples_per_pixel;
+    if (job->cancel_requested || job->failed) {
+        job->tile_finished(index);
+        return;
+    }
+
+    TRACE_SCOPE_ARG("tile pass", "tile", (long long)index);
+    cudaStream_t stream = worker_stream();
+    unsigned int pass =
+        std::min<unsigned int>(job->opts.pass_samples, goal - done);
+    cudaError_t err =
+        launch_render_tile(job->scene->world, job->d_cam, job->target,
+                           job->tiles[index], pass, goal, job->features, stream);
+    if (err == cudaSuccess) err = cudaStreamSynchronize(stream);
+    if (err != cudaSuccess) {
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        job->failed = true;
+        job->tile_finished(index);
+        return;
+    }
+
+    done += pass;
+    long long finished = ++job->finished_passes;
+    if (job->settings.on_progress)
+        job->settings.on_progress(double(finished) / job->total_passes);
+
+    if (done < goal) {
+        thread_pool::global().submit(
+            job->settings.priority,
+            [job, index, done] { run_tile(job, index, done); },
+            job->tile_node(index));
+    } else {
+        job->tile_finished(index);
+    }
+}
+
+void render_job::tile_finished(size_t index) {
+    TRACE_SCOPE_ARG("tile copy", "tile", (long long)index);
+    // Copy the tile out on the worker that rendered it, which places the
+    // output pages on its node.
+    const tile& t = tiles[index];
+    for (int y = t.y0; y < t.y1; y++) {
+        size_t row = size_t(y) * target.width;
+        std::copy(target.accum + row + t.x0, target.accum + row + t.x1,
+                  output.accum.begin() + row + t.x0);
+        std::copy(target.samples + row + t.x0, target.samples + row + t.x1,
+                  output.samples.begin() + row + t.x0);
+        std::copy(target.lum_sq + row + t.x0, target.lum_sq + row + t.x1,
+                  output.lum_sq.begin() + row + t.x0);
+    }
+
+    if (--remaining_tiles != 0) return;
+
+    job_result res;
+    res.ok = !failed;
+    res.cancelled = cancel_requested;
+    res.buffer = std::move(output);
+    count_local_pages(res);
+
+    cudaFree(d_cam);
+    cudaFree(target.accum);
+    cudaFree(target.samples);
+    cudaFree(target.lum_sq);
+    d_cam = nullptr;
+
+    deliver(std::move(res));
+}
+
+void render_job::deliver(job_result res) {
+    promise.set_value(std::move(res));
+    if (settings.on_finished) settings.on_finished();
+}
+
+void render_job::count_local_pages(job_result& res) const {
+    size_t nodes = thread_pool::global().nodes();
+    if (nodes < 2) return;
+
+    // A page is local when it sits on the node that rendered its first
+    // pixel, see tile_node. Both count nodes by position, not kernel id.
+    auto count = [&](const void* data, size_t pixel_bytes) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t base = reinterpret_cast<uintptr_t>(data);
+        std::vector<int> placement =
+            page_nodes(data, res.buffer.size() * pixel_bytes);
+        for (size_t p = 0; p < placement.size(); p++) {
+            uintptr_t page_start = (base / page + p) * page;
+            size_t pixel =
+                page_start > base ? (page_start - base) / pixel_bytes : 0;
+            size_t y = std::min(pixel / target.width, size_t(target.height - 1));
+            size_t tile_y0 = y / settings.tile_size * settings.tile_size;
+            int band = int(tile_y0 * nodes / target.height);
+            if (placement[p] == band) res.local_pages++;
+            res.total_pages++;
+        }
+    };
+    count(res.buffer.accum.data(), sizeof(color3));
+    count(res.buffer.samples.data(), sizeof(unsigned int));
+    count(res.buffer.lum_sq.data(), sizeof(double));
+}
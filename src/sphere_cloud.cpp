@@ -0,0 +1,142 @@
+#include "sphere_cloud.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "trace.hpp"
+
+static_assert(sizeof(packed_sphere) == 10, "packed_sphere must stay packed");
+static_assert(sizeof(cloud_node) == 32, "cloud_node must stay 32 bytes");
+
+// Widens [lo, hi] by a small relative margin. It covers float rounding of the
+// dequantised centers, which the device may compute with fused multiply-adds.
+static void pad_box(float lo[3], float hi[3]) {
+    for (int a = 0; a < 3; a++) {
+        float magnitude = std::fmax(std::fabs(lo[a]), std::fabs(hi[a]));
+        float pad = 1e-5f * (magnitude + (hi[a] - lo[a])) + FLT_MIN;
+        lo[a] = std::nextafter(lo[a] - pad, -FLT_MAX);
+        hi[a] = std::nextafter(hi[a] + pad, FLT_MAX);
+    }
+}
+
+static void build_leaf(sphere_cloud_data& cloud, int index,
+                       const std::vector<sphere_input>& input, int start,
+                       int end) {
+    float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    float max_radius = 0;
+    for (int i = start; i < end; i++) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::fmin(lo[a], input[i].center[a]);
+            hi[a] = std::fmax(hi[a], input[i].center[a]);
+        }
+        max_radius = std::fmax(max_radius, input[i].radius);
+    }
+
+    // One step for all axes, large enough for the center extent and for the
+    // largest radius to fit into 16 bits.
+    float extent = std::fmax(std::fmax(hi[0] - lo[0], hi[1] - lo[1]),
+                             std::fmax(hi[2] - lo[2], max_radius));
+    sphere_frame frame;
+    frame.step = std::fmax(extent / 65535.0f * (1 + 1e-6f), FLT_MIN);
+    for (int a = 0; a < 3; a++) frame.origin[a] = lo[a];
+    cloud.frames[start / sphere_cloud_leaf_size] = frame;
+
+    cloud_node& node = cloud.nodes[index];
+    for (int a = 0; a < 3; a++) {
+        node.lo[a] = FLT_MAX;
+        node.hi[a] = -FLT_MAX;
+    }
+
+    for (int i = start; i < end; i++) {
+        packed_sphere& s = cloud.spheres[i];
+        for (int a = 0; a < 3; a++) {
+            float q = std::round((input[i].center[a] - frame.origin[a]) /
+                                 frame.step);
+            s.center[a] = (unsigned short)std::fmin(std::fmax(q, 0.0f), 65535);
+        }
+        float r = std::ceil(input[i].radius / frame.step);
+        s.radius = (unsigned short)std::fmin(r, 65535);
+        s.material = input[i].material;
+
+        float radius = s.radius * frame.step;
+        for (int a = 0; a < 3; a++) {
+            float c = frame.origin[a] + s.center[a] * frame.step;
+            node.lo[a] = std::fmin(node.lo[a], c - radius);
+            node.hi[a] = std::fmax(node.hi[a], c + radius);
+        }
+    }
+
+    pad_box(node.lo, node.hi);
+    node.first = start;
+    node.count = end - start;
+}
+
+static void build_node(sphere_cloud_data& cloud, int index,
+                       std::vector<sphere_input>& input, int start, int end) {
+    const int leaf_size = sphere_cloud_leaf_size;
+    if (end - start <= leaf_size) {
+        build_leaf(cloud, index, input, start, end);
+        return;
+    }
+
+    float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = start; i < end; i++)
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::fmin(lo[a], input[i].center[a]);
+            hi[a] = std::fmax(hi[a], input[i].center[a]);
+        }
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+
+    // Split near the median, on a multiple of the leaf size so every leaf
+    // starts on a frame boundary.
+    int half = (end - start) / 2;
+    int mid = start + std::max(leaf_size, (half + leaf_size / 2) / leaf_size *
+                                              leaf_size);
+    std::nth_element(input.begin() + start, input.begin() + mid,
+                     input.begin() + end,
+                     [axis](const sphere_input& a, const sphere_input& b) {
+                         return a.center[axis] < b.center[axis];
+                     });
+
+    int left = cloud.nodes.size();
+    cloud.nodes.push_back(cloud_node());
+    cloud.nodes.push_back(cloud_node());
+
+    build_node(cloud, left, input, start, mid);
+    build_node(cloud, left + 1, input, mid, end);
+
+    cloud_node& node = cloud.nodes[index];
+    for (int a = 0; a < 3; a++) {
+        node.lo[a] = std::fmin(cloud.nodes[left].lo[a],
+                               cloud.nodes[left + 1].lo[a]);
+        node.hi[a] = std::fmax(cloud.nodes[left].hi[a],
+                               cloud.nodes[left + 1].hi[a]);
+    }
+    node.first = left;
+    node.count = 0;
+}
+
+sphere_cloud_data build_sphere_cloud(std::vector<sphere_input>& input) {
+    TRACE_SCOPE_ARG("sphere cloud build", "spheres", (long long)input.size());
+    sphere_cloud_data cloud;
+    if (input.empty()) return cloud;
+
+    size_t leaves =
+        (input.size() + sphere_cloud_leaf_size - 1) / sphere_cloud_leaf_size;
+    cloud.spheres.resize(input.size());
+    cloud.frames.resize(leaves);
+    cloud.nodes.reserve(2 * leaves);
+    cloud.nodes.push_back(cloud_node());
+
+    build_node(cloud, 0, input, 0, input.size());
+
+    const cloud_node& root = cloud.nodes[0];
+    cloud.bounds = aabb(point3(root.lo[0], root.lo[1], root.lo[2]),
+                        point3(root.hi[0], root.hi[1], root.hi[2]));
+    return cloud;
+}
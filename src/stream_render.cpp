@@ -0,0 +1,240 @@
+#include "stream_render.hpp"
+
+#include <cuda_runtime_api.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include "cuda/cu_render.hpp"
+#include "trace.hpp"
+
+namespace {
+
+constexpr int stream_tile_size = 256;  // Pixels per tile side
+constexpr int stream_slots = 4;        // Tiles in flight
+
+// Device buffers of a tile in flight, and pinned host memory for its result.
+struct tile_slot {
+    cudaStream_t stream = nullptr;
+    render_target target{};
+    color3* host_accum = nullptr;
+    unsigned int* host_samples = nullptr;
+    size_t tile_index = 0;
+    bool busy = false;
+};
+
+// Tonemapped rows of one band of tiles, written once all its tiles are in.
+struct band {
+    std::vector<unsigned char> rows;
+    size_t remaining_tiles;
+};
+
+void free_slot(tile_slot& s) {
+    if (s.stream != nullptr) cudaStreamDestroy(s.stream);
+    cudaFree(s.target.accum);
+    cudaFree(s.target.samples);
+    cudaFree(s.target.lum_sq);
+    cudaFreeHost(s.host_accum);
+    cudaFreeHost(s.host_samples);
+}
+
+}  // namespace
+
+bool render_streaming(const Allocator& scene, const cu_camera& cam,
+                      const render_options& opts, std::ostream& out) {
+    TRACE_SCOPE("streaming render");
+    using clock = std::chrono::steady_clock;
+
+    if (scene.pager != nullptr) {
+        std::cerr << "Streaming renders do not support paged scenes"
+                  << std::endl;
+        return false;
+    }
+
+    const int width = cam.image_width;
+    const int height = cam.image_height;
+    const int size = stream_tile_size;
+    const size_t tiles_x = (width + size - 1) / size;
+    const size_t total_tiles = tiles_x * ((height + size - 1) / size);
+    const size_t tile_pixels = size_t(size) * size;
+
+    // Tiles in scanline order, as make_tiles, without keeping the list.
+    auto tile_at = [&](size_t index) {
+        int x = int(index % tiles_x) * size;
+        int y = int(index / tiles_x) * size;
+        return tile{x, y, std::min(x + size, width), std::min(y + size, height)};
+    };
+
+    cu_camera* d_cam = nullptr;
+    unsigned long long* ray_count = nullptr;
+    std::vector<tile_slot> slots(stream_slots);
+
+    cudaError_t err = cudaMallocManaged(&d_cam, sizeof(cu_camera));
+    if (err == cudaSuccess && opts.stats)
+        err = cudaMallocManaged(&ray_count, sizeof(unsigned long long));
+    for (tile_slot& s : slots) {
+        render_target& t = s.target;
+        t.width = width;
+        t.height = height;
+        t.seed = opts.seed;
+        t.ray_count = ray_count;
+        if (err == cudaSuccess) err = cudaStreamCreate(&s.stream);
+        if (err == cudaSuccess)
+            err = cudaMalloc(&t.accum, tile_pixels * sizeof(color3));
+        if (err == cudaSuccess)
+            err = cudaMalloc(&t.samples, tile_pixels * sizeof(unsigned int));
+        if (err == cudaSuccess)
+            err = cudaMalloc(&t.lum_sq, tile_pixels * sizeof(double));
+        if (err == cudaSuccess)
+            err = cudaMallocHost(&s.host_accum, tile_pixels * sizeof(color3));
+        if (err == cudaSuccess)
+            err = cudaMallocHost(&s.host_samples,
+                                 tile_pixels * sizeof(unsigned int));
+    }
+
+    auto release = [&]() {
+        for (tile_slot& s : slots) free_slot(s);
+        cudaFree(d_cam);
+        cudaFree(ray_count);
+    };
+
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate streaming buffers on the GPU"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        release();
+        return false;
+    }
+
+    *d_cam = cam;
+    if (ray_count != nullptr) *ray_count = 0;
+    unsigned int features = scene.render_features(cam, false, opts.stats);
+    unsigned int goal = opts.samples_per_pixel;
+
+    // Queues all passes of a tile and the copy of its result on the slot's
+    // stream.
+    auto launch = [&](tile_slot& s, size_t index) {
+        tile region = tile_at(index);
+        size_t pixels = size_t(region.width()) * region.height();
+        s.tile_index = index;
+        s.busy = true;
+        s.target.window = region;
+
+        cudaMemsetAsync(s.target.accum, 0, pixels * sizeof(color3), s.stream);
+        cudaMemsetAsync(s.target.samples, 0, pixels * sizeof(unsigned int),
+                        s.stream);
+        cudaMemsetAsync(s.target.lum_sq, 0, pixels * sizeof(double), s.stream);
+        for (unsigned int done = 0; done < goal && err == cudaSuccess;
+             done += opts.pass_samples)
+            err = launch_render_tile(scene.world, d_cam, s.target, region,
+                                     opts.pass_samples, goal, features,
+                                     s.stream);
+        cudaMemcpyAsync(s.host_accum, s.target.accum, pixels * sizeof(color3),
+                        cudaMemcpyDeviceToHost, s.stream);
+        cudaMemcpyAsync(s.host_samples, s.target.samples,
+                        pixels * sizeof(unsigned int), cudaMemcpyDeviceToHost,
+                        s.stream);
+    };
+
+    // Bands from `first_band` on that still wait for tiles or for output.
+    std::deque<band> bands;
+    size_t first_band = 0;
+    auto band_of = [&](size_t index) -> band& {
+        size_t b = index / tiles_x;
+        while (first_band + bands.size() <= b) {
+            int y0 = int(first_band + bands.size()) * size;
+            int rows = std::min(size, height - y0);
+            bands.push_back(
+                band{std::vector<unsigned char>(size_t(width) * rows * 3),
+                     tiles_x});
+        }
+        return bands[b - first_band];
+    };
+
+    auto collect = [&](tile_slot& s) {
+        const tile& region = s.target.window;
+        band& b = band_of(s.tile_index);
+        for (int y = region.y0; y < region.y1; y++) {
+            unsigned char* row =
+                b.rows.data() + size_t(y - region.y0) * width * 3;
+            for (int x = region.x0; x < region.x1; x++) {
+                size_t p = s.target.index(x, y);
+                color3 c = s.host_samples[p]
+                               ? s.host_accum[p] / s.host_samples[p]
+                               : color3(0, 0, 0);
+                color_to_bytes(c, row + size_t(x) * 3);
+            }
+        }
+        b.remaining_tiles--;
+        s.busy = false;
+    };
+
+    // Bands complete in order except at the edge of the window, so writes
+    // stay sequential and `out` can be a pipe.
+    auto flush = [&]() {
+        while (!bands.empty() && bands.front().remaining_tiles == 0) {
+            const std::vector<unsigned char>& rows = bands.front().rows;
+            out.write(reinterpret_cast<const char*>(rows.data()), rows.size());
+            bands.pop_front();
+            first_band++;
+        }
+        return bool(out);
+    };
+
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+
+    auto start = clock::now();
+    size_t next = 0;
+    size_t finished = 0;
+    for (tile_slot& s : slots)
+        if (next < total_tiles) launch(s, next++);
+
+    // Slots are launched round robin, so visiting them in the same order
+    // collects tiles in scanline order.
+    bool ok = true;
+    for (size_t k = 0; finished < total_tiles; k = (k + 1) % slots.size()) {
+        tile_slot& s = slots[k];
+        if (!s.busy) continue;
+
+        // A failed launch shows up here too.
+        if (err == cudaSuccess) err = cudaStreamSynchronize(s.stream);
+        if (err != cudaSuccess) {
+            std::cerr << "CUDA error: " << cudaGetErrorString(err)
+                      << std::endl;
+            ok = false;
+            break;
+        }
+
+        TRACE_SCOPE_ARG("stream tile output", "tile", (long long)s.tile_index);
+        collect(s);
+        finished++;
+        if (next < total_tiles) launch(s, next++);
+
+        if (!flush()) {
+            std::cerr << "Could not write the streamed image" << std::endl;
+            ok = false;
+            break;
+        }
+        std::clog << "\rTiles: " << finished << " / " << total_tiles << ' '
+                  << std::flush;
+    }
+    std::clog << "\rDone.                 \n";
+
+    // Drains the slots still in flight after a failure.
+    cudaDeviceSynchronize();
+    out.flush();
+
+    std::chrono::duration<double> total = clock::now() - start;
+    std::clog << "Streamed " << width << 'x' << height << " pixels at " << goal
+              << " samples per pixel in " << total.count() << "s" << std::endl;
+    if (ray_count != nullptr)
+        std::clog << "Traced " << *ray_count << " rays, "
+                  << *ray_count / total.count() / 1e6 << " Mrays/s"
+                  << std::endl;
+
+    release();
+    return ok && bool(out);
+}
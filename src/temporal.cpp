@@ -0,0 +1,130 @@
+#include "temporal.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Relative difference of first hit distances still taken for the same
+// surface; depth changes faster than this across a pixel only at grazing
+// angles, where rejecting history is harmless.
+static const double depth_tolerance = 0.05;
+
+static bool same_surface(double depth, double expected) {
+    if (std::isinf(expected)) return std::isinf(depth);
+    return std::fabs(depth - expected) <= depth_tolerance * expected;
+}
+
+/* Flags the pixels with a first hit distance discontinuity in their 3x3
+ * neighbourhood. Such pixels cover more than one surface, so their means are
+ * a mix that no single distance reprojects: they neither provide nor receive
+ * history.
+ */
+static std::vector<unsigned char> depth_edges(const std::vector<float>& depth,
+                                              int width, int height) {
+    std::vector<unsigned char> edges(depth.size(), 0);
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++) {
+            double d = depth[size_t(j) * width + i];
+            for (int y = std::max(j - 1, 0); y <= std::min(j + 1, height - 1);
+                 y++)
+                for (int x = std::max(i - 1, 0);
+                     x <= std::min(i + 1, width - 1); x++)
+                    if (!same_surface(depth[size_t(y) * width + x], d))
+                        edges[size_t(j) * width + i] = 1;
+        }
+    return edges;
+}
+
+// Direction of the ray through the center of pixel (i, j).
+static vec3 pixel_direction(const cu_camera& cam, int i, int j) {
+    return cam.pixel00_loc + i * cam.pixel_delta_u + j * cam.pixel_delta_v -
+           cam.center;
+}
+
+// Continuous pixel coordinates, pixel centers at integers, at which `cam`
+// sees direction `d` from its center. False behind the camera.
+static bool project(const cu_camera& cam, const vec3& d, double& x,
+                    double& y) {
+    double forward = dot(d, -cam.w);
+    if (forward <= 0) return false;
+
+    vec3 on_plane = cam.center + d * (cam.focus_distance / forward) -
+                    cam.pixel00_loc;
+    x = dot(on_plane, cam.pixel_delta_u) / cam.pixel_delta_u.length_squared();
+    y = dot(on_plane, cam.pixel_delta_v) / cam.pixel_delta_v.length_squared();
+    return true;
+}
+
+reprojection_stats reproject(const frame_history& history,
+                             const cu_camera& cam,
+                             const std::vector<float>& depth,
+                             unsigned int max_samples, render_buffer& buffer) {
+    reprojection_stats stats;
+    const cu_camera& prev = history.camera;
+    const render_buffer& old = history.buffer;
+    std::vector<unsigned char> old_edges =
+        depth_edges(history.depth, old.width, old.height);
+    std::vector<unsigned char> edges =
+        depth_edges(depth, buffer.width, buffer.height);
+
+    for (int j = 0; j < buffer.height; j++) {
+        for (int i = 0; i < buffer.width; i++) {
+            size_t p = size_t(j) * buffer.width + i;
+            vec3 direction = unit_vector(pixel_direction(cam, i, j));
+            bool sky = std::isinf(depth[p]);
+
+            // Where the previous camera saw this pixel's first hit, and how
+            // far away it was from it.
+            vec3 seen = direction;
+            double expected = inf;
+            if (!sky) {
+                seen = cam.center + depth[p] * direction - prev.center;
+                expected = seen.length();
+            }
+
+            double x, y;
+            color3 mean(0, 0, 0);
+            double mean_sq = 0, count = 0, weights = 0;
+            // Reflections and refractions (NaN distances) move against the
+            // surface, they start afresh as well.
+            if (max_samples > 0 && !edges[p] && !std::isnan(depth[p]) &&
+                project(prev, seen, x, y)) {
+                int x0 = int(std::floor(x)), y0 = int(std::floor(y));
+                double fx = x - x0, fy = y - y0;
+                for (int k = 0; k < 4; k++) {
+                    int xi = x0 + (k & 1), yi = y0 + (k >> 1);
+                    if (xi < 0 || yi < 0 || xi >= old.width ||
+                        yi >= old.height)
+                        continue;
+                    size_t q = size_t(yi) * old.width + xi;
+                    unsigned int n = old.samples[q];
+                    if (n == 0 || old_edges[q] ||
+                        !same_surface(history.depth[q], expected))
+                        continue;
+
+                    double w = ((k & 1) ? fx : 1 - fx) *
+                               ((k >> 1) ? fy : 1 - fy);
+                    mean += w * old.accum[q] / n;
+                    mean_sq += w * old.lum_sq[q] / n;
+                    count += w * n;
+                    weights += w;
+                }
+            }
+
+            if (weights < 1e-3) {
+                buffer.accum[p] = color3(0, 0, 0);
+                buffer.samples[p] = 0;
+                buffer.lum_sq[p] = 0;
+                stats.rejected++;
+                continue;
+            }
+
+            unsigned int n = (unsigned int)std::lround(count / weights);
+            n = std::min(std::max(n, 1u), max_samples);
+            buffer.accum[p] = mean / weights * n;
+            buffer.samples[p] = n;
+            buffer.lum_sq[p] = mean_sq / weights * n;
+            stats.reused++;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,141 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+// Next header token of a PPM file, skipping comments.
+static bool read_token(std::istream& in, std::string& token) {
+    token.clear();
+    char c;
+    while (in.get(c)) {
+        if (c == '#') {
+            while (in.get(c) && c != '\n') {
+            }
+        } else if (!std::isspace((unsigned char)c)) {
+            token += c;
+            break;
+        }
+    }
+    while (in.get(c) && !std::isspace((unsigned char)c)) token += c;
+    return !token.empty();
+}
+
+bool load_ppm(const std::string& path, rgb_image& image) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open image " << path << std::endl;
+        return false;
+    }
+
+    std::string magic, width, height, maxval;
+    if (!read_token(in, magic) || (magic != "P3" && magic != "P6") ||
+        !read_token(in, width) || !read_token(in, height) ||
+        !read_token(in, maxval)) {
+        std::cerr << "Not a PPM image: " << path << std::endl;
+        return false;
+    }
+
+    int w = std::atoi(width.c_str());
+    int h = std::atoi(height.c_str());
+    int max = std::atoi(maxval.c_str());
+    if (w < 1 || h < 1 || max < 1 || max > 255) {
+        std::cerr << "Unsupported PPM image (size or depth): " << path
+                  << std::endl;
+        return false;
+    }
+
+    image.width = w;
+    image.height = h;
+    image.rgb.resize(size_t(w) * h * 3);
+    if (magic == "P6") {
+        in.read(reinterpret_cast<char*>(image.rgb.data()), image.rgb.size());
+    } else {
+        for (unsigned char& c : image.rgb) {
+            int v;
+            if (!(in >> v)) break;
+            c = std::min(v, max);
+        }
+    }
+    if (!in) {
+        std::cerr << "PPM image is truncated: " << path << std::endl;
+        return false;
+    }
+
+    if (max != 255)
+        for (unsigned char& c : image.rgb) c = c * 255 / max;
+    return true;
+}
+
+// Texels are gamma encoded with gamma 2, like the rendered images.
+static float decode(unsigned char c) {
+    float x = c / 255.0f;
+    return x * x;
+}
+
+static unsigned char encode(float linear) {
+    return (unsigned char)(std::sqrt(std::min(std::max(linear, 0.0f), 1.0f)) *
+                               255.0f +
+                           0.5f);
+}
+
+texture_pyramid build_pyramid(const rgb_image& image) {
+    texture_pyramid pyramid;
+    int w = image.width;
+    int h = image.height;
+    std::vector<float> linear(image.rgb.size());
+    for (size_t i = 0; i < linear.size(); i++) linear[i] = decode(image.rgb[i]);
+
+    const int size = texture_tile_size;
+    int first_tile = 0;
+    while (true) {
+        texture_level level;
+        level.width = w;
+        level.height = h;
+        level.tiles_x = (w + size - 1) / size;
+        level.first_tile = first_tile;
+        int tiles_y = (h + size - 1) / size;
+        pyramid.levels.push_back(level);
+
+        for (int ty = 0; ty < tiles_y; ty++) {
+            for (int tx = 0; tx < level.tiles_x; tx++) {
+                for (int y = 0; y < size; y++) {
+                    for (int x = 0; x < size; x++) {
+                        int sx = std::min(tx * size + x, w - 1);
+                        int sy = std::min(ty * size + y, h - 1);
+                        const float* p = &linear[(size_t(sy) * w + sx) * 3];
+                        pyramid.tiles.push_back(
+                            texel{encode(p[0]), encode(p[1]), encode(p[2]), 0});
+                    }
+                }
+            }
+        }
+        first_tile += level.tiles_x * tiles_y;
+
+        if (w == 1 && h == 1) break;
+
+        // Box filter down to the next level; odd edges reuse their last
+        // row or column.
+        int nw = (w + 1) / 2;
+        int nh = (h + 1) / 2;
+        std::vector<float> next(size_t(nw) * nh * 3);
+        for (int y = 0; y < nh; y++) {
+            int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < nw; x++) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                for (int c = 0; c < 3; c++) {
+                    float sum = linear[(size_t(y0) * w + x0) * 3 + c] +
+                                linear[(size_t(y0) * w + x1) * 3 + c] +
+                                linear[(size_t(y1) * w + x0) * 3 + c] +
+                                linear[(size_t(y1) * w + x1) * 3 + c];
+                    next[(size_t(y) * nw + x) * 3 + c] = 0.25f * sum;
+                }
+            }
+        }
+        linear.swap(next);
+        w = nw;
+        h = nh;
+    }
+    return pyramid;
+}
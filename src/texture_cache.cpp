@@ -0,0 +1,207 @@
+#include "texture_cache.hpp"
+
+#include <cuda_runtime_api.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "trace.hpp"
+
+// Frees a page table and whatever parts of it were allocated.
+static void free_pages(texture_pages* pages) {
+    if (pages == nullptr) return;
+    cudaFree(pages->levels);
+    cudaFree(pages->tile_slot);
+    cudaFree(pages->requests);
+    cudaFree(pages->touched);
+    cudaFree(pages);
+}
+
+texture_cache::~texture_cache() {
+    for (texture_entry& t : textures) free_pages(t.pages);
+    cudaFree(d_slots);
+}
+
+bool texture_cache::open(size_t cache_bytes) {
+    cache_tiles = std::max<size_t>(1, cache_bytes / (texture_tile_texels *
+                                                     sizeof(texel)));
+    cudaError_t err =
+        cudaMalloc(&d_slots, cache_tiles * texture_tile_texels * sizeof(texel));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate the texture cache on the GPU"
+                  << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        d_slots = nullptr;
+        return false;
+    }
+
+    slot_owner.assign(cache_tiles, -1);
+    locked.assign(cache_tiles, 0);
+    pinned.assign(cache_tiles, 0);
+    for (size_t s = cache_tiles; s-- > 0;) free_slots.push_back(int(s));
+    counters.cache_tiles = cache_tiles;
+    return true;
+}
+
+bool texture_cache::add(texture_pyramid pyramid, texture_pages*& pages) {
+    TRACE_SCOPE("texture upload");
+    size_t tiles = pyramid.num_tiles();
+    size_t num_levels = pyramid.levels.size();
+
+    pages = nullptr;
+    cudaError_t err = cudaMallocManaged(&pages, sizeof(texture_pages));
+    if (err != cudaSuccess) pages = nullptr;
+    if (err == cudaSuccess) {
+        *pages = texture_pages();
+        err = cudaMallocManaged(&pages->levels,
+                                num_levels * sizeof(texture_level));
+    }
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&pages->tile_slot, tiles * sizeof(int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&pages->requests, tiles * sizeof(unsigned int));
+    if (err == cudaSuccess)
+        err = cudaMallocManaged(&pages->touched, tiles * sizeof(unsigned int));
+    if (err != cudaSuccess) {
+        std::cerr << "Could not allocate a texture page table" << std::endl;
+        std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+        free_pages(pages);
+        pages = nullptr;
+        return false;
+    }
+
+    std::copy(pyramid.levels.begin(), pyramid.levels.end(), pages->levels);
+    pages->num_levels = num_levels;
+    std::fill(pages->tile_slot, pages->tile_slot + tiles, -1);
+    std::fill(pages->requests, pages->requests + tiles, 0);
+    std::fill(pages->touched, pages->touched + tiles, 0);
+    pages->slots = d_slots;
+
+    size_t index = textures.size();
+    textures.push_back(texture_entry{std::move(pyramid), pages});
+    counters.tiles += tiles;
+    const std::vector<texture_level>& levels = textures.back().pyramid.levels;
+
+    // The single tile levels are the fallback of every lookup.
+    size_t level = num_levels;
+    while (level > 0 && levels[level - 1].tiles_x == 1 &&
+           levels[level - 1].height <= texture_tile_size) {
+        level--;
+        int slot = take_slot();
+        if (slot < 0) {
+            std::cerr << "Texture cache is too small for the coarse levels of "
+                      << textures.size() << " textures" << std::endl;
+            remove_last();
+            pages = nullptr;
+            return false;
+        }
+        load(index, levels[level].first_tile, slot);
+        locked[slot] = 1;
+    }
+
+    // Finer levels while there is room, coarse to fine.
+    while (level-- > 0) {
+        int first = levels[level].first_tile;
+        int last = level + 1 < num_levels ? levels[level + 1].first_tile
+                                          : int(tiles);
+        for (int tile = first; tile < last; tile++) {
+            if (free_slots.empty()) return true;
+            int slot = free_slots.back();
+            free_slots.pop_back();
+            load(index, tile, slot);
+        }
+    }
+    return true;
+}
+
+void texture_cache::remove_last() {
+    size_t index = textures.size() - 1;
+    for (size_t slot = 0; slot < cache_tiles; slot++) {
+        if (slot_owner[slot] < 0 || size_t(slot_owner[slot] >> 32) != index)
+            continue;
+        slot_owner[slot] = -1;
+        locked[slot] = 0;
+        free_slots.push_back(int(slot));
+    }
+    counters.tiles -= textures.back().pyramid.num_tiles();
+    free_pages(textures.back().pages);
+    textures.pop_back();
+}
+
+int texture_cache::take_slot() {
+    if (!free_slots.empty()) {
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    // Clock replacement as in paged_scene. Two rounds clear every touched
+    // bit, so finding nothing means all slots are locked or pinned.
+    for (size_t step = 0; step < 2 * cache_tiles; step++) {
+        size_t slot = clock_hand;
+        clock_hand = (clock_hand + 1) % cache_tiles;
+        if (locked[slot] || pinned[slot]) continue;
+
+        long long owner = slot_owner[slot];
+        texture_pages* pages = textures[owner >> 32].pages;
+        int tile = int(owner & 0xffffffff);
+        if (pages->touched[tile]) {
+            pages->touched[tile] = 0;
+            continue;
+        }
+
+        pages->tile_slot[tile] = -1;
+        slot_owner[slot] = -1;
+        counters.evictions++;
+        return int(slot);
+    }
+    return -1;
+}
+
+void texture_cache::load(size_t texture, int tile, int slot) {
+    const texture_entry& t = textures[texture];
+    cudaMemcpy(d_slots + size_t(slot) * texture_tile_texels,
+               t.pyramid.tiles.data() + size_t(tile) * texture_tile_texels,
+               texture_tile_texels * sizeof(texel), cudaMemcpyHostToDevice);
+    t.pages->tile_slot[tile] = slot;
+    slot_owner[slot] = (long long)texture << 32 | tile;
+    counters.loads++;
+}
+
+size_t texture_cache::service() {
+    if (textures.empty()) return 0;
+    TRACE_SCOPE("texture page in");
+
+    std::vector<std::pair<size_t, int>> wanted;
+    for (size_t i = 0; i < textures.size(); i++) {
+        texture_pages* pages = textures[i].pages;
+        int tiles = int(textures[i].pyramid.num_tiles());
+        for (int tile = 0; tile < tiles; tile++) {
+            if (!pages->requests[tile]) continue;
+            pages->requests[tile] = 0;
+            if (pages->tile_slot[tile] < 0) wanted.push_back({i, tile});
+        }
+    }
+
+    // Leave room for the tiles the next pass uses again.
+    size_t limit = std::max<size_t>(1, cache_tiles / 2);
+    if (wanted.size() > limit) wanted.resize(limit);
+
+    pinned.assign(cache_tiles, 0);
+    size_t loaded = 0;
+    for (const auto& w : wanted) {
+        int slot = take_slot();
+        if (slot < 0) break;
+        load(w.first, w.second, slot);
+        pinned[slot] = 1;
+        textures[w.first].pages->touched[w.second] = 1;
+        loaded++;
+    }
+    return loaded;
+}
+
+texture_cache_stats texture_cache::stats() const {
+    texture_cache_stats s = counters;
+    s.resident_tiles = cache_tiles - free_slots.size();
+    return s;
+}
@@ -0,0 +1,147 @@
+#include "trace.hpp"
+
+#ifdef RT_TRACING
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct event {
+    const char* name;
+    const char* arg_name;
+    long long arg;
+    long long start_ns;
+    long long end_ns;
+};
+
+constexpr size_t ring_size = 1 << 15;  // Events per thread, a power of two
+
+/* Events of one thread. Only the owning thread writes; `head` counts the
+ * events ever written and is published after every event, so the dump reads
+ * complete events only.
+ */
+struct ring {
+    std::vector<event> events = std::vector<event>(ring_size);
+    std::atomic<unsigned long long> head{0};
+    std::string thread_name;
+    int tid = 0;
+};
+
+const clock::time_point epoch = clock::now();
+
+// Rings outlive their threads so that events of finished threads are still
+// dumped. The lock is only taken when a thread records its first event.
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ring>> registry;
+
+ring& thread_ring() {
+    static thread_local ring* own = nullptr;
+    if (own == nullptr) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::make_unique<ring>());
+        own = registry.back().get();
+        own->tid = registry.size();
+    }
+    return *own;
+}
+
+long long since_epoch(clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - epoch)
+        .count();
+}
+
+void write_escaped(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+}  // namespace
+
+void record(const char* name, const char* arg_name, long long arg,
+            clock::time_point start, clock::time_point end) {
+    ring& r = thread_ring();
+    unsigned long long head = r.head.load(std::memory_order_relaxed);
+    r.events[head & (ring_size - 1)] =
+        event{name, arg_name, arg, since_epoch(start), since_epoch(end)};
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+void set_thread_name(const std::string& name) {
+    ring& r = thread_ring();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    r.thread_name = name;
+}
+
+bool dump(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Could not open trace file " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) out << ",\n";
+        first = false;
+    };
+
+    size_t lost = 0;
+    for (const auto& r : registry) {
+        if (!r->thread_name.empty()) {
+            separator();
+            out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+                << r->tid << ",\"args\":{\"name\":";
+            write_escaped(out, r->thread_name);
+            out << "}}";
+        }
+
+        unsigned long long head = r->head.load(std::memory_order_acquire);
+        unsigned long long begin = head > ring_size ? head - ring_size : 0;
+        lost += begin;
+        for (unsigned long long i = begin; i < head; i++) {
+            const event& e = r->events[i & (ring_size - 1)];
+            separator();
+            // Chrome expects microseconds.
+            out << "{\"ph\":\"X\",\"name\":";
+            write_escaped(out, e.name);
+            out << ",\"pid\":1,\"tid\":" << r->tid
+                << ",\"ts\":" << e.start_ns / 1000.0
+                << ",\"dur\":" << (e.end_ns - e.start_ns) / 1000.0;
+            if (e.arg_name != nullptr) {
+                out << ",\"args\":{";
+                write_escaped(out, e.arg_name);
+                out << ':' << e.arg << '}';
+            }
+            out << '}';
+        }
+    }
+    out << "\n]}\n";
+
+    if (lost > 0)
+        std::clog << "Trace buffers wrapped, " << lost
+                  << " early events were dropped" << std::endl;
+    if (!out) {
+        std::cerr << "Could not write trace file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace trace
+
+#endif
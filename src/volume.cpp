@@ -0,0 +1,85 @@
+#include "volume.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+bool load_density_grid(const std::string& path, density_grid& grid) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open volume " << path << std::endl;
+        return false;
+    }
+
+    // "VOL", version 3, then little endian int32 encoding, resolution and
+    // channel count and the float32 bounding box.
+    char magic[4] = {};
+    int32_t header[5];
+    float box[6];
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    in.read(reinterpret_cast<char*>(box), sizeof(box));
+    if (!in || magic[0] != 'V' || magic[1] != 'O' || magic[2] != 'L' ||
+        magic[3] != 3) {
+        std::cerr << "Not a gridvolume (.vol version 3): " << path
+                  << std::endl;
+        return false;
+    }
+    const int32_t encoding = header[0], channels = header[4];
+    if (encoding != 1 || channels < 1 || header[1] < 1 || header[2] < 1 ||
+        header[3] < 1) {
+        std::cerr << "Unsupported gridvolume (needs float32 data): " << path
+                  << std::endl;
+        return false;
+    }
+
+    grid.nx = header[1];
+    grid.ny = header[2];
+    grid.nz = header[3];
+    grid.bounds = aabb(point3(box[0], box[1], box[2]),
+                       point3(box[3], box[4], box[5]));
+    const size_t voxels = size_t(grid.nx) * grid.ny * grid.nz;
+    std::vector<float> data(voxels * channels);
+    if (!in.read(reinterpret_cast<char*>(data.data()),
+                 data.size() * sizeof(float))) {
+        std::cerr << "Gridvolume is truncated: " << path << std::endl;
+        return false;
+    }
+
+    // Negative densities would break the majorants; treat them as empty.
+    grid.values.resize(voxels);
+    for (size_t v = 0; v < voxels; v++)
+        grid.values[v] = std::max(data[v * channels], 0.0f);
+    return true;
+}
+
+majorant_grid build_majorants(const density_grid& grid, int block) {
+    majorant_grid m;
+    m.block = block;
+    m.nx = (grid.nx + block - 1) / block;
+    m.ny = (grid.ny + block - 1) / block;
+    m.nz = (grid.nz + block - 1) / block;
+    m.values.assign(size_t(m.nx) * m.ny * m.nz, 0.0f);
+
+    // A lookup in block b interpolates voxels b * block - 1 up to
+    // (b + 1) * block, so every voxel counts towards the blocks it borders.
+    for (int z = 0; z < grid.nz; z++)
+        for (int y = 0; y < grid.ny; y++)
+            for (int x = 0; x < grid.nx; x++) {
+                float v = grid.values[(size_t(z) * grid.ny + y) * grid.nx + x];
+                if (v <= 0) continue;
+                for (int bz = std::max((z - 1) / block, 0);
+                     bz <= std::min((z + 1) / block, m.nz - 1); bz++)
+                    for (int by = std::max((y - 1) / block, 0);
+                         by <= std::min((y + 1) / block, m.ny - 1); by++)
+                        for (int bx = std::max((x - 1) / block, 0);
+                             bx <= std::min((x + 1) / block, m.nx - 1);
+                             bx++) {
+                            float& slot =
+                                m.values[(size_t(bz) * m.ny + by) * m.nx + bx];
+                            slot = std::max(slot, v);
+                        }
+            }
+    return m;
+}